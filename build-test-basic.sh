@@ -13,6 +13,7 @@ tests=(
   "quicksort"
   "matrixmulti"
   "ackermann"
+  "test_ntl"
 )
 
 # Compile each test file
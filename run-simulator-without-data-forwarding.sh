@@ -14,8 +14,8 @@ for riscv_file in ../riscv-elf/*.riscv; do
    echo "Running $riscv_file without data forwarding"
    # For test_syscall.riscv, we need to send "1\na" to stdin
     if [ "$(basename "$riscv_file" .riscv)" == "test_syscall" ]; then
-        echo -e "1\na" | ./Simulator "$riscv_file" -x > "../results-without-data-forwarding/$(basename "$riscv_file" .riscv).txt"
+        echo -e "1\na" | ./Simulator "$riscv_file" -x -u -L > "../results-without-data-forwarding/$(basename "$riscv_file" .riscv).txt"
         continue
     fi
-  ./Simulator "$riscv_file" -x > "../results-without-data-forwarding/$(basename "$riscv_file" .riscv).txt"
+  ./Simulator "$riscv_file" -x -u -L > "../results-without-data-forwarding/$(basename "$riscv_file" .riscv).txt"
 done
\ No newline at end of file
@@ -0,0 +1,88 @@
+/*
+ * Implementation of the basic block vector profiler
+ */
+
+#include <cinttypes>
+
+#include "BBVProfiler.h"
+
+BBVProfiler::BBVProfiler() {
+  this->file = nullptr;
+  this->intervalSize = 0;
+  this->intervals = 0;
+  this->blockStart = 0;
+  this->blockInst = 0;
+  this->intervalInst = 0;
+}
+
+BBVProfiler::~BBVProfiler() { this->close(); }
+
+bool BBVProfiler::open(const char *path, uint64_t intervalSize) {
+  this->close();
+  this->file = fopen(path, "w");
+  if (this->file == nullptr) {
+    return false;
+  }
+  setvbuf(this->file, nullptr, _IOFBF, 1 << 20);
+  this->intervalSize = intervalSize;
+  this->intervals = 0;
+  this->blockInst = 0;
+  this->intervalInst = 0;
+  this->blockIds.clear();
+  for (uint32_t i = 0; i < LOOKUP_SIZE; ++i) {
+    this->lookup[i].id = 0;
+  }
+  this->counts.assign(1, 0); // ids start at 1
+  this->touched.clear();
+  return true;
+}
+
+bool BBVProfiler::close() {
+  if (this->file == nullptr) {
+    return true;
+  }
+  if (this->blockInst > 0) {
+    this->endBlock();
+  }
+  if (this->intervalInst > 0) {
+    this->writeInterval();
+  }
+  bool good = fclose(this->file) == 0;
+  this->file = nullptr;
+  return good;
+}
+
+void BBVProfiler::endBlock() {
+  LookupEntry &entry = this->lookup[(this->blockStart >> 2) % LOOKUP_SIZE];
+  if (entry.id == 0 || entry.pc != this->blockStart) {
+    uint32_t &id = this->blockIds[this->blockStart];
+    if (id == 0) {
+      id = this->counts.size();
+      this->counts.push_back(0);
+    }
+    entry.pc = this->blockStart;
+    entry.id = id;
+  }
+  uint32_t id = entry.id;
+  if (this->counts[id] == 0) {
+    this->touched.push_back(id);
+  }
+  this->counts[id] += this->blockInst;
+  this->intervalInst += this->blockInst;
+  this->blockInst = 0;
+  if (this->intervalInst >= this->intervalSize) {
+    this->writeInterval();
+  }
+}
+
+void BBVProfiler::writeInterval() {
+  fputc('T', this->file);
+  for (uint32_t id : this->touched) {
+    fprintf(this->file, ":%u:%" PRIu64 " ", id, this->counts[id]);
+    this->counts[id] = 0;
+  }
+  fputc('\n', this->file);
+  this->touched.clear();
+  this->intervalInst = 0;
+  this->intervals++;
+}
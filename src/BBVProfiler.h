@@ -0,0 +1,73 @@
+/*
+ * Basic block vector profiler for SimPoint
+ *
+ * A basic block ends at every branch or jump and is identified by the PC of
+ * its first instruction. For each interval of intervalSize instructions the
+ * profiler writes one line in the SimPoint .bb format,
+ *
+ *   T:id:count :id:count ...
+ *
+ * where ids start at 1 and count is the number of instructions executed in
+ * that block during the interval. Intervals are closed at the first block
+ * boundary after intervalSize instructions.
+ */
+
+#ifndef BBV_PROFILER_H
+#define BBV_PROFILER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <vector>
+
+class BBVProfiler {
+public:
+  BBVProfiler();
+  ~BBVProfiler();
+  BBVProfiler(const BBVProfiler &) = delete;
+  BBVProfiler &operator=(const BBVProfiler &) = delete;
+
+  bool open(const char *path, uint64_t intervalSize);
+  // Writes the last partial interval
+  bool close();
+
+  // Called once for every executed instruction in program order
+  void retire(uint32_t pc, bool endsBlock) {
+    if (this->blockInst == 0) {
+      this->blockStart = pc;
+    }
+    this->blockInst++;
+    if (endsBlock) {
+      this->endBlock();
+    }
+  }
+
+  uint32_t blockNum() { return this->blockIds.size(); }
+  uint64_t intervalNum() { return this->intervals; }
+
+private:
+  FILE *file;
+  uint64_t intervalSize;
+  uint64_t intervals;
+
+  uint32_t blockStart;
+  uint32_t blockInst;
+  uint64_t intervalInst;
+
+  std::unordered_map<uint32_t, uint32_t> blockIds; // start PC to id
+  // Direct-mapped cache of recent blockIds lookups, indexed by start PC
+  static const uint32_t LOOKUP_SIZE = 4096;
+  struct LookupEntry {
+    uint32_t pc;
+    uint32_t id; // 0 if empty
+  } lookup[LOOKUP_SIZE];
+  // Instructions per block id in the current interval, and the ids with a
+  // nonzero count in the order they were first seen
+  std::vector<uint64_t> counts;
+  std::vector<uint32_t> touched;
+
+  void endBlock();
+  void writeInterval();
+};
+
+#endif
@@ -83,4 +83,12 @@ std::string BranchPredictor::strategyName() {
     break;
   }
   return "error"; // should not go here
-}
\ No newline at end of file
+}
+
+bool BranchPredictor::saveState(FILE *file) {
+  return fwrite(this->predbuf, sizeof(this->predbuf), 1, file) == 1;
+}
+
+bool BranchPredictor::loadState(FILE *file) {
+  return fread(this->predbuf, sizeof(this->predbuf), 1, file) == 1;
+}
@@ -12,6 +12,7 @@
 #define BRANCH_PREDICTOR_H
 
 #include <cstdint>
+#include <cstdio>
 #include <string>
 
 const int PRED_BUF_SIZE = 4096;
@@ -36,6 +37,10 @@ public:
 
   std::string strategyName();
 
+  // Prediction buffer contents, for checkpoints
+  bool saveState(FILE *file);
+  bool loadState(FILE *file);
+
 private:
   enum PredictorState {
     STRONG_TAKEN = 0, WEAK_TAKEN = 1,
@@ -0,0 +1,34 @@
+/*
+ * Implementation of the bypass predictor
+ */
+
+#include "BypassPredictor.h"
+
+BypassPredictor::BypassPredictor() {
+  for (uint32_t i = 0; i < TABLE_SIZE; ++i) {
+    this->counters[i] = 0;
+  }
+  this->sampleCounter = 0;
+}
+
+bool BypassPredictor::shouldBypass(uint32_t pc) {
+  if (pc == 0 || this->counters[this->getIndex(pc)] < COUNTER_MAX) {
+    return false;
+  }
+  this->sampleCounter = (this->sampleCounter + 1) % SAMPLE_PERIOD;
+  return this->sampleCounter != 0;
+}
+
+void BypassPredictor::recordReuse(uint32_t pc) {
+  uint8_t &counter = this->counters[this->getIndex(pc)];
+  if (counter > 0) {
+    counter--;
+  }
+}
+
+void BypassPredictor::recordDeadEviction(uint32_t pc) {
+  uint8_t &counter = this->counters[this->getIndex(pc)];
+  if (counter < COUNTER_MAX) {
+    counter++;
+  }
+}
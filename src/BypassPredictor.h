@@ -0,0 +1,41 @@
+/*
+ * PC-based reuse predictor for cache bypassing
+ *
+ * Each line remembers the PC of the miss that filled it. When a line is
+ * evicted before it was hit again, the counter of that PC goes up, and the
+ * first hit on a line brings it down. Once the counter of a PC saturates,
+ * its misses are predicted dead on arrival and skip the cache, so streams
+ * that are touched once do not evict lines that are reused.
+ *
+ * One predicted bypass in SAMPLE_PERIOD still fills the line, so a PC whose
+ * lines become reused again is noticed.
+ */
+
+#ifndef BYPASS_PREDICTOR_H
+#define BYPASS_PREDICTOR_H
+
+#include <cstdint>
+
+class BypassPredictor {
+public:
+  BypassPredictor();
+
+  // Whether a miss of the instruction at pc should not allocate a line, pc
+  // is 0 when unknown and then never bypasses
+  bool shouldBypass(uint32_t pc);
+  // A line filled by a miss of pc was hit again, or evicted without
+  void recordReuse(uint32_t pc);
+  void recordDeadEviction(uint32_t pc);
+
+private:
+  static const uint32_t TABLE_SIZE = 1024;
+  static const uint8_t COUNTER_MAX = 7;
+  static const uint32_t SAMPLE_PERIOD = 32;
+
+  uint8_t counters[TABLE_SIZE];
+  uint32_t sampleCounter;
+
+  uint32_t getIndex(uint32_t pc) { return (pc >> 2) % TABLE_SIZE; }
+};
+
+#endif
@@ -4,14 +4,52 @@
  * Created By He, Hao in 2019-04-27
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+
+#include <strings.h>
 
 #include "Cache.h"
 
+namespace {
+
+const char *INCLUSIONNAME[] = {"NINE", "Inclusive", "Exclusive"};
+
+} // namespace
+
+bool Cache::parseInclusion(const char *name, Inclusion *inclusion) {
+  for (int i = 0; i < INCLUSION_NUM; ++i) {
+    if (strcasecmp(name, INCLUSIONNAME[i]) == 0) {
+      *inclusion = Inclusion(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *Cache::getInclusionName(Inclusion inclusion) {
+  if (inclusion < 0 || inclusion >= INCLUSION_NUM) {
+    return "Unknown";
+  }
+  return INCLUSIONNAME[inclusion];
+}
+
 Cache::Cache(MemoryManager *manager, Policy policy, Cache *lowerCache,
              bool writeBack, bool writeAllocate) {
-  this->referenceCounter = 0;
+  this->lastAccessDepth = 0;
+  this->lastTiming.accept = 0;
+  this->lastTiming.ready = 0;
+  this->accessPC = 0;
+  this->accessCycle = 0;
+  this->accessBypass = 0;
+  this->upperFill = false;
+  this->lastFillDirty = false;
+  this->timingOnly = false;
+  this->pendingVictim = nullptr;
+  this->filling = false;
+  this->fillLine = 0;
   this->memory = manager;
   this->policy = policy;
   this->lowerCache = lowerCache;
@@ -19,16 +57,36 @@ Cache::Cache(MemoryManager *manager, Policy policy, Cache *lowerCache,
     fprintf(stderr, "Policy invalid!\n");
     exit(-1);
   }
+  if (lowerCache != nullptr) {
+    if (lowerCache->policy.inclusion != NINE &&
+        lowerCache->policy.blockSize != policy.blockSize) {
+      fprintf(stderr,
+              "%s lower level has %u B blocks, the upper level %u B\n",
+              getInclusionName(lowerCache->policy.inclusion),
+              lowerCache->policy.blockSize, policy.blockSize);
+      exit(-1);
+    }
+    lowerCache->upperCaches.push_back(this);
+  }
   this->initCache();
-  this->statistics.numRead = 0;
-  this->statistics.numWrite = 0;
-  this->statistics.numHit = 0;
-  this->statistics.numMiss = 0;
-  this->statistics.totalCycles = 0;
+  this->resetStatistics();
   this->writeBack = writeBack;
   this->writeAllocate = writeAllocate;
 }
 
+Cache::~Cache() {
+  if (this->lowerCache != nullptr) {
+    std::vector<Cache *> &uppers = this->lowerCache->upperCaches;
+    uppers.erase(std::remove(uppers.begin(), uppers.end(), this),
+                 uppers.end());
+  }
+  free(this->data);
+  free(this->victimBuffer);
+  delete this->replacement;
+  delete this->prefetcher;
+  delete this->bypassPredictor;
+}
+
 bool Cache::inCache(uint32_t addr) {
   return getBlockId(addr) != -1 ? true : false;
 }
@@ -38,13 +96,10 @@ uint32_t Cache::getBlockId(uint32_t addr) {
   uint32_t id = this->getId(addr);
   // printf("0x%x 0x%x 0x%x\n", addr, tag, id);
   // iterate over the given set
-  for (uint32_t i = id * policy.associativity;
-       i < (id + 1) * policy.associativity; ++i) {
-    if (this->blocks[i].id != id) {
-      fprintf(stderr, "Inconsistent ID in block %d\n", i);
-      exit(-1);
-    }
-    if (this->blocks[i].valid && this->blocks[i].tag == tag) {
+  uint32_t begin = id * policy.associativity;
+  uint32_t end = begin + policy.associativity;
+  for (uint32_t i = begin; i < end; ++i) {
+    if (this->tags[i] == tag && this->valid[i]) {
       return i;
     }
   }
@@ -52,81 +107,292 @@ uint32_t Cache::getBlockId(uint32_t addr) {
 }
 
 uint8_t Cache::getByte(uint32_t addr, uint32_t *cycles) {
-  this->referenceCounter++;
-  this->statistics.numRead++;
+  return this->read(addr, 1, cycles);
+}
 
-  // If in cache, return directly
-  int blockId;
-  if ((blockId = this->getBlockId(addr)) != -1) {
-    uint32_t offset = this->getOffset(addr);
-    this->statistics.numHit++;
-    this->statistics.totalCycles += this->policy.hitLatency;
-    this->blocks[blockId].lastReference = this->referenceCounter;
-    if (cycles) *cycles = this->policy.hitLatency;
-    return this->blocks[blockId].data[offset];
+void Cache::setByte(uint32_t addr, uint8_t val, uint32_t *cycles) {
+  this->write(addr, 1, val, cycles);
+}
+
+uint32_t Cache::read(uint32_t addr, uint32_t len, uint32_t *cycles) {
+  uint8_t data[4];
+  this->readBlock(addr, len, data, cycles);
+  uint32_t val = 0;
+  for (uint32_t i = 0; i < len; ++i) {
+    val |= uint32_t(data[i]) << (8 * i);
   }
+  return val;
+}
 
-  // Else, find the data in memory or other level of cache
-  this->statistics.numMiss++;
-  this->statistics.totalCycles += this->policy.missLatency;
-  this->loadBlockFromLowerLevel(addr, cycles);
+void Cache::write(uint32_t addr, uint32_t len, uint32_t val,
+                  uint32_t *cycles) {
+  uint8_t data[4];
+  for (uint32_t i = 0; i < len; ++i) {
+    data[i] = (val >> (8 * i)) & 0xFF;
+  }
+  this->writeBlock(addr, len, data, cycles);
+}
 
-  // The block is in top level cache now, return directly
-  if ((blockId = this->getBlockId(addr)) != -1) {
-    uint32_t offset = this->getOffset(addr);
-    this->blocks[blockId].lastReference = this->referenceCounter;
-    return this->blocks[blockId].data[offset];
-  } else {
-    fprintf(stderr, "Error: data not in top level cache!\n");
-    exit(-1);
+void Cache::readBlock(uint32_t addr, uint32_t len, uint8_t *data,
+                      uint32_t *cycles) {
+  this->accessBlock(addr, len, data, false, cycles);
+}
+
+void Cache::writeBlock(uint32_t addr, uint32_t len, const uint8_t *data,
+                       uint32_t *cycles) {
+  this->accessBlock(addr, len, const_cast<uint8_t *>(data), true, cycles);
+}
+
+void Cache::peekBlock(uint32_t addr, uint32_t len, uint8_t *data) {
+  while (len > 0) {
+    uint32_t chunk = this->policy.blockSize - this->getOffset(addr);
+    if (chunk > len)
+      chunk = len;
+    int blockId = this->getBlockId(addr);
+    if (blockId != -1) {
+      memcpy(data, this->getLineData(blockId) + this->getOffset(addr), chunk);
+    } else {
+      if (this->lowerCache != nullptr) {
+        this->lowerCache->peekBlock(addr, chunk, data);
+      } else {
+        this->memory->readBlockNoCache(addr, chunk, data);
+      }
+      // Stores still waiting in the write buffer are newer
+      uint32_t line = addr & ~(this->policy.blockSize - 1);
+      for (uint32_t i = 0; i < this->writeBufferCount; ++i) {
+        WriteBufferEntry &entry = this->getWriteBufferEntry(i);
+        if (entry.line != line || entry.draining) {
+          continue;
+        }
+        size_t base = size_t(&entry - &this->writeBuffer[0]) *
+                          this->policy.blockSize +
+                      this->getOffset(addr);
+        for (uint32_t j = 0; j < chunk; ++j) {
+          if (this->writeBufferMask[base + j]) {
+            data[j] = this->writeBufferData[base + j];
+          }
+        }
+      }
+    }
+    addr += chunk;
+    data += chunk;
+    len -= chunk;
   }
 }
 
-void Cache::setByte(uint32_t addr, uint8_t val, uint32_t *cycles) {
-  this->referenceCounter++;
-  this->statistics.numWrite++;
+// Splits an access at line boundaries. The lines are accessed one after
+// another, so the latency and timing cover all of them, and the depth is
+// the deepest any of them went.
+void Cache::accessBlock(uint32_t addr, uint32_t len, uint8_t *data,
+                        bool isWrite, uint32_t *cycles) {
+  uint64_t issue = this->accessCycle;
+  Timing timing = {issue, issue};
+  uint32_t depth = 0;
+  bool first = true;
+  while (len > 0) {
+    uint32_t chunk = this->policy.blockSize - this->getOffset(addr);
+    if (chunk > len)
+      chunk = len;
+    Prefetcher::Outcome outcome = this->accessLine(addr, chunk, data, isWrite);
+    if (first || !this->policy.flatLatency) {
+      if (first) {
+        timing.accept = this->lastTiming.accept;
+      }
+      timing.ready = this->lastTiming.ready;
+      if (this->lastAccessDepth > depth)
+        depth = this->lastAccessDepth;
+    }
+    first = false;
+    if (this->prefetcher != nullptr) {
+      this->issuePrefetches(addr, outcome);
+    }
+    addr += chunk;
+    data += chunk;
+    len -= chunk;
+    if (len > 0 && !this->policy.flatLatency) {
+      this->setAccessInfo(this->accessPC, timing.ready, this->accessBypass);
+    }
+  }
+  this->lastAccessDepth = depth;
+  this->lastTiming = timing;
+  if (cycles) *cycles = uint32_t(timing.ready - issue);
+}
+
+// Access len bytes that all lie within the line containing addr, issued at
+// accessCycle. The latency is the tag lookup, plus the fill and the
+// writeback of a dirty victim on a miss, plus the write to the lower level
+// in a write-through cache, or the wait for a write buffer slot. A bypassed
+// miss costs the lookup and the access to the lower level instead.
+Prefetcher::Outcome Cache::accessLine(uint32_t addr, uint32_t len,
+                                      uint8_t *data, bool isWrite) {
+  if (this->optPolicy != nullptr) {
+    this->optPolicy->advance();
+  }
+  if (isWrite) {
+    this->statistics.numWrite++;
+  } else {
+    this->statistics.numRead++;
+  }
+  // A fill of an upper level takes the line from an exclusive level
+  bool exclusiveFill =
+      this->upperFill && this->policy.inclusion == EXCLUSIVE;
+  this->lastFillDirty = false;
+  uint64_t issue = this->accessCycle;
+  uint64_t lookup = issue + this->policy.hitLatency;
+  uint64_t accept = issue;
+  uint64_t ready = lookup;
+  Prefetcher::Outcome outcome = Prefetcher::HIT;
+  if (this->writeBufferCount > 0) {
+    this->drainWriteBuffer(issue);
+  }
 
-  // If in cache, write to it directly
+  // If in cache, access it directly
   int blockId;
   if ((blockId = this->getBlockId(addr)) != -1) {
-    uint32_t offset = this->getOffset(addr);
     this->statistics.numHit++;
-    this->statistics.totalCycles += this->policy.hitLatency;
-    this->blocks[blockId].modified = true;
-    this->blocks[blockId].lastReference = this->referenceCounter;
-    this->blocks[blockId].data[offset] = val;
-    if (!this->writeBack) {
-      this->writeBlockToLowerLevel(this->blocks[blockId]);
-      this->statistics.totalCycles += this->policy.missLatency;
+    if (this->prefetcher != nullptr && this->prefetched[blockId]) {
+      // First use of a prefetched line, which may still be on its way
+      this->prefetched[blockId] = false;
+      outcome = Prefetcher::PREFETCH_HIT;
+      if (this->prefetchReady[blockId] > issue) {
+        this->statistics.numPrefetchLate++;
+        if (this->prefetchReady[blockId] > ready)
+          ready = this->prefetchReady[blockId];
+      } else {
+        this->statistics.numPrefetchUseful++;
+      }
+    }
+    if (!this->mshrs.empty()) {
+      // A secondary miss, the line is still being filled by an earlier one
+      MSHR *mshr = this->findMSHR(this->getAddr(blockId), issue);
+      if (mshr != nullptr && mshr->ready > ready) {
+        this->statistics.numMSHRMerge++;
+        ready = mshr->ready;
+      }
+    }
+    if (this->bypassPredictor != nullptr && !this->reused[blockId]) {
+      this->reused[blockId] = true;
+      this->bypassPredictor->recordReuse(this->fillPC[blockId]);
+    }
+    uint32_t id = this->getId(addr);
+    this->replacement->touch(id, blockId - id * this->policy.associativity);
+    this->lastAccessDepth = 0;
+  } else {
+    // Else, find the data in memory or other level of cache. An exclusive
+    // level passes a write of a line held above straight down, it is
+    // neither a hit nor a miss here.
+    bool exclusive =
+        this->policy.inclusion == EXCLUSIVE && !this->upperCaches.empty();
+    bool heldAbove = exclusive && this->isHeldAbove(addr);
+    bool passThrough = isWrite && heldAbove;
+    if (passThrough) {
+      this->statistics.numPassThrough++;
+    } else {
+      this->statistics.numMiss++;
+    }
+    outcome = Prefetcher::MISS;
+    if (this->prefetcher != nullptr && !passThrough) {
+      uint32_t slot = this->getPollutionSlot(addr);
+      if (this->pollutionValid[slot] &&
+          this->pollutionTags[slot] == (addr >> this->offsetBits)) {
+        this->pollutionValid[slot] = false;
+        this->statistics.numPrefetchPolluting++;
+      }
     }
-    if (cycles) *cycles = this->policy.hitLatency;
-    return;
-  }
 
-  // Else, load the data from cache
-  // TODO: implement bypassing
-  this->statistics.numMiss++;
-  this->statistics.totalCycles += this->policy.missLatency;
+    // A bypassed miss, a write miss without write allocate, and a miss of
+    // an upper level's fill go to the lower level without filling a line
+    // here. So does any miss of an exclusive level on a line held above,
+    // such as a write through the level above.
+    bool bypass = this->accessBypass > 0 ||
+                  (this->bypassPredictor != nullptr &&
+                   this->bypassPredictor->shouldBypass(this->accessPC));
+    if (bypass || exclusiveFill || (isWrite && !this->writeAllocate) ||
+        heldAbove) {
+      uint32_t lowerBypass =
+          this->accessBypass > 0 ? this->accessBypass - 1 : 0;
+      if (bypass) {
+        this->statistics.numBypass++;
+      }
+      if (isWrite && !this->writeBuffer.empty()) {
+        ready = this->bufferWrite(addr, len, data, lookup);
+        this->lastAccessDepth = 1;
+      } else {
+        if (isWrite) {
+          ready = this->writeToLowerLevel(addr, len, data, lookup, lowerBypass);
+        } else {
+          uint32_t line = addr & ~(this->policy.blockSize - 1);
+          ready = this->readFromLowerLevel(
+              addr, len, data,
+              std::max(lookup, this->flushWriteBuffer(line)), lowerBypass,
+              exclusiveFill);
+          if (exclusiveFill && this->lowerCache != nullptr &&
+              this->lowerCache->lastFillDirty) {
+            ready = this->passDirtyUp(addr, data, ready);
+          }
+        }
+        this->lastAccessDepth = this->lowerCache == nullptr
+                                    ? 1
+                                    : 1 + this->lowerCache->lastAccessDepth;
+      }
+      if (!passThrough) {
+        this->statistics.totalCycles += ready - issue;
+      }
+      this->lastTiming.accept = accept;
+      this->lastTiming.ready = ready;
+      return outcome;
+    }
 
-  if (this->writeAllocate) {
-    this->loadBlockFromLowerLevel(addr, cycles);
+    // The block is in top level cache after the fill, access it directly
+    blockId = this->loadBlockFromLowerLevel(addr, lookup);
+    accept = this->lastTiming.accept;
+    ready = this->lastTiming.ready;
+  }
 
-    if ((blockId = this->getBlockId(addr)) != -1) {
-      uint32_t offset = this->getOffset(addr);
-      this->blocks[blockId].modified = true;
-      this->blocks[blockId].lastReference = this->referenceCounter;
-      this->blocks[blockId].data[offset] = val;
-      return;
-    } else {
-      fprintf(stderr, "Error: data not in top level cache!\n");
-      exit(-1);
+  uint8_t *line = this->getLineData(blockId) + this->getOffset(addr);
+  if (isWrite) {
+    this->modified[blockId] = true;
+    memcpy(line, data, len);
+    if (!this->writeBack) {
+      if (!this->writeBuffer.empty()) {
+        ready = this->bufferWrite(addr, len, data, ready);
+      } else {
+        ready = this->writeToLowerLevel(this->getAddr(blockId),
+                                        this->policy.blockSize,
+                                        this->getLineData(blockId), ready);
+      }
     }
   } else {
-    if (this->lowerCache == nullptr) {
-      this->memory->setByteNoCache(addr, val);
-    } else {
-      this->lowerCache->setByte(addr, val);
+    memcpy(data, line, len);
+    if (exclusiveFill) {
+      ready = this->moveLineUp(blockId, ready);
+    }
+  }
+  this->statistics.totalCycles += ready - issue;
+  this->lastTiming.accept = accept;
+  this->lastTiming.ready = ready;
+  return outcome;
+}
+
+// Fills the lines the prefetcher asks for that are not present yet
+void Cache::issuePrefetches(uint32_t addr, Prefetcher::Outcome outcome) {
+  this->prefetchQueue.clear();
+  this->prefetcher->observe(addr, this->accessPC, outcome,
+                            this->prefetchQueue);
+  // An exclusive level does not prefetch lines held above it
+  bool exclusive = this->policy.inclusion == EXCLUSIVE;
+  for (uint32_t line : this->prefetchQueue) {
+    if (this->inCache(line) || (exclusive && this->isHeldAbove(line))) {
+      continue;
     }
+    // Prefetches are dropped rather than waiting for an MSHR
+    if (!this->mshrs.empty() &&
+        this->getFreeMSHR()->ready > this->accessCycle) {
+      break;
+    }
+    this->statistics.numPrefetch++;
+    this->loadBlockFromLowerLevel(
+        line, this->accessCycle + this->policy.hitLatency, true);
   }
 }
 
@@ -138,13 +404,23 @@ void Cache::printInfo(bool verbose) {
   printf("Associativiy: %d\n", this->policy.associativity);
   printf("Hit Latency: %d\n", this->policy.hitLatency);
   printf("Miss Latency: %d\n", this->policy.missLatency);
+  printf("Replacement: %s\n",
+         ReplacementPolicy::getKindName(this->policy.replacement));
+  printf("Prefetcher: %s\n",
+         Prefetcher::getKindName(this->policy.prefetcher));
+  printf("MSHRs: %d\n", this->policy.mshrNum);
+  printf("Write Buffer: %d\n", this->policy.writeBufferSize);
+  printf("Bypass Predictor: %s\n", this->policy.predictBypass ? "yes" : "no");
+  printf("Inclusion: %s\n", getInclusionName(this->policy.inclusion));
 
   if (verbose) {
-    for (int j = 0; j < this->blocks.size(); ++j) {
-      const Block &b = this->blocks[j];
-      printf("Block %d: tag 0x%x id %d %s %s (last ref %d)\n", j, b.tag, b.id,
-             b.valid ? "valid" : "invalid",
-             b.modified ? "modified" : "unmodified", b.lastReference);
+    for (uint32_t j = 0; j < this->policy.blockNum; ++j) {
+      uint32_t id = j / this->policy.associativity;
+      printf("Block %d: tag 0x%x id %d %s %s (replacement state %d)\n", j,
+             this->tags[j], id, this->valid[j] ? "valid" : "invalid",
+             this->modified[j] ? "modified" : "unmodified",
+             this->replacement->getLineState(
+                 id, j - id * this->policy.associativity));
       // printf("Data: ");
       // for (uint8_t d : b.data)
       // printf("%d ", d);
@@ -153,6 +429,188 @@ void Cache::printInfo(bool verbose) {
   }
 }
 
+uint32_t Cache::getLastAccessDepth() { return this->lastAccessDepth; }
+
+Cache::Timing Cache::getLastTiming() { return this->lastTiming; }
+
+bool Cache::isNonBlocking() { return !this->mshrs.empty(); }
+
+uint32_t Cache::getLevelNum() {
+  if (this->lowerCache == nullptr) {
+    return 1;
+  }
+  return 1 + this->lowerCache->getLevelNum();
+}
+
+Cache *Cache::getLowerCache() { return this->lowerCache; }
+
+ReplacementPolicy *Cache::getReplacementPolicy() { return this->replacement; }
+
+void Cache::setAccessInfo(uint32_t pc, uint64_t cycle, uint32_t bypassLevels) {
+  this->accessPC = pc;
+  this->accessCycle = cycle;
+  this->accessBypass = bypassLevels;
+  if (this->lowerCache != nullptr) {
+    this->lowerCache->setAccessInfo(pc, cycle,
+                                    bypassLevels > 0 ? bypassLevels - 1 : 0);
+  }
+}
+
+void Cache::setNextUse(const std::vector<uint32_t> *nextUse) {
+  if (this->optPolicy != nullptr) {
+    this->optPolicy->setNextUse(nextUse);
+  }
+}
+
+void Cache::setTimingOnly() { this->timingOnly = true; }
+
+void Cache::resetStatistics() {
+  this->statistics.numRead = 0;
+  this->statistics.numWrite = 0;
+  this->statistics.numHit = 0;
+  this->statistics.numMiss = 0;
+  this->statistics.totalCycles = 0;
+  this->statistics.numPrefetch = 0;
+  this->statistics.numPrefetchUseful = 0;
+  this->statistics.numPrefetchLate = 0;
+  this->statistics.numPrefetchUnused = 0;
+  this->statistics.numPrefetchPolluting = 0;
+  this->statistics.numMSHRMerge = 0;
+  this->statistics.numMSHRFull = 0;
+  this->statistics.missCycles = 0;
+  this->statistics.missActiveCycles = 0;
+  this->statistics.numWriteCombine = 0;
+  this->statistics.numWriteBufferFull = 0;
+  this->statistics.numBypass = 0;
+  this->statistics.numBackInvalidate = 0;
+  this->statistics.numVictimInsert = 0;
+  this->statistics.numPassThrough = 0;
+  // The clock restarts with the statistics, outstanding misses are dropped
+  // and buffered stores are written out before the lower levels reset
+  this->drainWriteBuffer(UINT64_MAX);
+  this->writeBufferFree = 0;
+  for (MSHR &mshr : this->mshrs) {
+    mshr.ready = 0;
+  }
+  this->missActiveEnd = 0;
+  this->replacement->resetStatistics();
+  if (this->lowerCache != nullptr) {
+    this->lowerCache->resetStatistics();
+  }
+}
+
+void Cache::syncMemory() {
+  // Lower levels first, an upper level may hold newer data for the line
+  if (this->lowerCache != nullptr) {
+    this->lowerCache->syncMemory();
+  }
+  for (uint32_t i = 0; i < this->writeBufferCount; ++i) {
+    WriteBufferEntry &entry = this->getWriteBufferEntry(i);
+    if (entry.draining) {
+      continue; // already in the lower level
+    }
+    size_t base = size_t(&entry - &this->writeBuffer[0]) *
+                  this->policy.blockSize;
+    for (uint32_t j = entry.dirtyBegin; j < entry.dirtyEnd; ++j) {
+      if (this->writeBufferMask[base + j]) {
+        this->memory->writeBlockNoCache(entry.line + j, 1,
+                                        &this->writeBufferData[base + j]);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < this->policy.blockNum; ++i) {
+    if (this->valid[i] && this->modified[i]) {
+      this->memory->writeBlockNoCache(this->getAddr(i), this->policy.blockSize,
+                                      this->getLineData(i));
+    }
+  }
+}
+
+bool Cache::saveState(FILE *file, bool lowerLevels) {
+  // The write buffer is not saved, the lower levels get its stores first
+  this->drainWriteBuffer(UINT64_MAX);
+  uint32_t geometry[5] = {this->policy.cacheSize, this->policy.blockSize,
+                          this->policy.associativity,
+                          this->policy.replacement, this->policy.prefetcher};
+  uint32_t blockNum = this->policy.blockNum;
+  size_t dataSize = size_t(blockNum) * this->policy.blockSize;
+  bool good =
+      fwrite(geometry, sizeof(geometry), 1, file) == 1 &&
+      fwrite(this->tags.data(), 4, blockNum, file) == blockNum &&
+      fwrite(this->valid.data(), 1, blockNum, file) == blockNum &&
+      fwrite(this->modified.data(), 1, blockNum, file) == blockNum &&
+      this->replacement->saveState(file) &&
+      fwrite(this->data, 1, dataSize, file) == dataSize;
+  if (good && this->prefetcher != nullptr) {
+    good = fwrite(this->prefetched.data(), 1, blockNum, file) == blockNum &&
+           fwrite(this->prefetchReady.data(), 8, blockNum, file) ==
+               blockNum &&
+           fwrite(this->pollutionTags.data(), 4, blockNum, file) ==
+               blockNum &&
+           fwrite(this->pollutionValid.data(), 1, blockNum, file) ==
+               blockNum &&
+           this->prefetcher->saveState(file);
+  }
+  if (good && lowerLevels && this->lowerCache != nullptr) {
+    good = this->lowerCache->saveState(file);
+  }
+  return good;
+}
+
+bool Cache::loadState(FILE *file, bool lowerLevels) {
+  uint32_t geometry[5];
+  if (fread(geometry, sizeof(geometry), 1, file) != 1) {
+    return false;
+  }
+  if (geometry[0] != this->policy.cacheSize ||
+      geometry[1] != this->policy.blockSize ||
+      geometry[2] != this->policy.associativity) {
+    fprintf(stderr,
+            "Checkpoint has a %u B cache with %u B blocks and %u ways, "
+            "expected %u B, %u B and %u ways\n",
+            geometry[0], geometry[1], geometry[2], this->policy.cacheSize,
+            this->policy.blockSize, this->policy.associativity);
+    return false;
+  }
+  if (geometry[3] != uint32_t(this->policy.replacement)) {
+    fprintf(stderr,
+            "Checkpoint has a cache with %s replacement, expected %s\n",
+            ReplacementPolicy::getKindName(
+                ReplacementPolicy::Kind(geometry[3])),
+            ReplacementPolicy::getKindName(this->policy.replacement));
+    return false;
+  }
+  if (geometry[4] != uint32_t(this->policy.prefetcher)) {
+    fprintf(stderr,
+            "Checkpoint has a cache with %s prefetching, expected %s\n",
+            Prefetcher::getKindName(Prefetcher::Kind(geometry[4])),
+            Prefetcher::getKindName(this->policy.prefetcher));
+    return false;
+  }
+  uint32_t blockNum = this->policy.blockNum;
+  size_t dataSize = size_t(blockNum) * this->policy.blockSize;
+  bool good =
+      fread(this->tags.data(), 4, blockNum, file) == blockNum &&
+      fread(this->valid.data(), 1, blockNum, file) == blockNum &&
+      fread(this->modified.data(), 1, blockNum, file) == blockNum &&
+      this->replacement->loadState(file) &&
+      fread(this->data, 1, dataSize, file) == dataSize;
+  if (good && this->prefetcher != nullptr) {
+    good = fread(this->prefetched.data(), 1, blockNum, file) == blockNum &&
+           fread(this->prefetchReady.data(), 8, blockNum, file) == blockNum &&
+           fread(this->pollutionTags.data(), 4, blockNum, file) == blockNum &&
+           fread(this->pollutionValid.data(), 1, blockNum, file) ==
+               blockNum &&
+           this->prefetcher->loadState(file);
+  }
+  // The bypass predictor does not train on the lines restored
+  std::fill(this->reused.begin(), this->reused.end(), true);
+  if (good && lowerLevels && this->lowerCache != nullptr) {
+    good = this->lowerCache->loadState(file);
+  }
+  return good;
+}
+
 void Cache::printStatistics() {
   printf("-------- STATISTICS ----------\n");
   printf("Num Read: %d\n", this->statistics.numRead);
@@ -160,6 +618,42 @@ void Cache::printStatistics() {
   printf("Num Hit: %d\n", this->statistics.numHit);
   printf("Num Miss: %d\n", this->statistics.numMiss);
   printf("Total Cycles: %llu\n", this->statistics.totalCycles);
+  uint32_t accesses = this->statistics.numHit + this->statistics.numMiss;
+  printf("AMAT: %.2f cycles\n",
+         accesses != 0 ? (double)this->statistics.totalCycles / accesses
+                       : 0.0);
+  this->replacement->printStatistics();
+  if (this->prefetcher != nullptr) {
+    printf("Num Prefetch: %d\n", this->statistics.numPrefetch);
+    printf("Prefetch Useful: %d Late: %d Unused: %d Polluting: %d\n",
+           this->statistics.numPrefetchUseful,
+           this->statistics.numPrefetchLate,
+           this->statistics.numPrefetchUnused,
+           this->statistics.numPrefetchPolluting);
+  }
+  if (!this->mshrs.empty()) {
+    printf("MSHR Merged: %d Full: %d MLP: %.2f\n",
+           this->statistics.numMSHRMerge, this->statistics.numMSHRFull,
+           this->statistics.missActiveCycles != 0
+               ? (double)this->statistics.missCycles /
+                     this->statistics.missActiveCycles
+               : 0.0);
+  }
+  if (!this->writeBuffer.empty()) {
+    printf("Write Buffer Combined: %d Full: %d\n",
+           this->statistics.numWriteCombine,
+           this->statistics.numWriteBufferFull);
+  }
+  if (this->bypassPredictor != nullptr || this->statistics.numBypass != 0) {
+    printf("Num Bypass: %d\n", this->statistics.numBypass);
+  }
+  if (this->statistics.numBackInvalidate != 0) {
+    printf("Num Back Invalidated: %d\n", this->statistics.numBackInvalidate);
+  }
+  if (this->policy.inclusion == EXCLUSIVE && !this->upperCaches.empty()) {
+    printf("Num Victim Insert: %d\n", this->statistics.numVictimInsert);
+    printf("Num Pass Through: %d\n", this->statistics.numPassThrough);
+  }
   if (this->lowerCache != nullptr) {
     printf("---------- LOWER CACHE ----------\n");
     this->lowerCache->printStatistics();
@@ -187,90 +681,541 @@ bool Cache::isPolicyValid() {
     fprintf(stderr, "blockNum %% associativity != 0\n");
     return false;
   }
+  if (!ReplacementPolicy::isAssociativitySupported(policy.replacement,
+                                                   policy.associativity)) {
+    fprintf(stderr, "%s replacement does not support associativity %d\n",
+            ReplacementPolicy::getKindName(policy.replacement),
+            policy.associativity);
+    return false;
+  }
+  if (policy.replacement == ReplacementPolicy::OPT &&
+      policy.prefetcher != Prefetcher::NONE) {
+    fprintf(stderr, "OPT replacement does not support prefetching\n");
+    return false;
+  }
+  if (policy.inclusion == INCLUSIVE && policy.predictBypass) {
+    fprintf(stderr, "An inclusive cache cannot bypass the fills of the "
+                    "levels above\n");
+    return false;
+  }
   return true;
 }
 
 void Cache::initCache() {
-  this->blocks = std::vector<Block>(policy.blockNum);
-  for (uint32_t i = 0; i < this->blocks.size(); ++i) {
-    Block &b = this->blocks[i];
-    b.valid = false;
-    b.modified = false;
-    b.size = policy.blockSize;
-    b.tag = 0;
-    b.id = i / policy.associativity;
-    b.lastReference = 0;
-    b.data = std::vector<uint8_t>(b.size);
+  uint32_t blockNum = this->policy.blockNum;
+  this->offsetBits = this->log2i(this->policy.blockSize);
+  this->setBits = this->log2i(blockNum / this->policy.associativity);
+  this->tags = std::vector<uint32_t>(blockNum, 0);
+  this->valid = std::vector<uint8_t>(blockNum, false);
+  this->modified = std::vector<uint8_t>(blockNum, false);
+  this->mshrs = std::vector<MSHR>(this->policy.mshrNum, MSHR{0, 0});
+  uint32_t bufferSize = this->policy.writeBufferSize;
+  this->writeBuffer = std::vector<WriteBufferEntry>(bufferSize);
+  this->writeBufferHead = 0;
+  this->writeBufferCount = 0;
+  this->writeBufferFree = 0;
+  this->writeBufferData =
+      std::vector<uint8_t>(size_t(bufferSize) * this->policy.blockSize, 0);
+  this->writeBufferMask =
+      std::vector<uint8_t>(size_t(bufferSize) * this->policy.blockSize, 0);
+  this->prefetcher =
+      Prefetcher::create(this->policy.prefetcher, this->policy.blockSize);
+  if (this->prefetcher != nullptr) {
+    this->prefetched = std::vector<uint8_t>(blockNum, false);
+    this->prefetchReady = std::vector<uint64_t>(blockNum, 0);
+    this->pollutionTags = std::vector<uint32_t>(blockNum, 0);
+    this->pollutionValid = std::vector<uint8_t>(blockNum, false);
+  }
+  this->bypassPredictor = nullptr;
+  if (this->policy.predictBypass) {
+    this->bypassPredictor = new BypassPredictor();
+    this->fillPC = std::vector<uint32_t>(blockNum, 0);
+    this->reused = std::vector<uint8_t>(blockNum, true);
+  }
+  this->replacement = ReplacementPolicy::create(
+      this->policy.replacement, blockNum / this->policy.associativity,
+      this->policy.associativity);
+  this->optPolicy = this->policy.replacement == ReplacementPolicy::OPT
+                        ? static_cast<OPTPolicy *>(this->replacement)
+                        : nullptr;
+
+  size_t arenaSize = size_t(blockNum) * this->policy.blockSize;
+  if (posix_memalign((void **)&this->data, 64, arenaSize) != 0 ||
+      posix_memalign((void **)&this->victimBuffer, 64,
+                     this->policy.blockSize) != 0) {
+    fprintf(stderr, "Failed to allocate %zu bytes of cache data\n", arenaSize);
+    exit(-1);
   }
+  memset(this->data, 0, arenaSize);
 }
 
-void Cache::loadBlockFromLowerLevel(uint32_t addr, uint32_t *cycles) {
+// Fills the line holding addr, the request leaves this level at cycle. Sets
+// lastTiming and lastAccessDepth.
+uint32_t Cache::loadBlockFromLowerLevel(uint32_t addr, uint64_t cycle,
+                                        bool isPrefetch) {
   uint32_t blockSize = this->policy.blockSize;
+  uint32_t blockAddrBegin = addr & ~(blockSize - 1);
 
-  // Initialize new block from memory
-  Block b;
-  b.valid = true;
-  b.modified = false;
-  b.tag = this->getTag(addr);
-  b.id = this->getId(addr);
-  b.size = blockSize;
-  b.data = std::vector<uint8_t>(b.size);
-  uint32_t bits = this->log2i(blockSize);
-  uint32_t mask = ~((1 << bits) - 1);
-  uint32_t blockAddrBegin = addr & mask;
-  for (uint32_t i = blockAddrBegin; i < blockAddrBegin + blockSize; ++i) {
-    if (this->lowerCache == nullptr) {
-      b.data[i - blockAddrBegin] = this->memory->getByteNoCache(i);
-      if (cycles) *cycles = 100;
-    } else 
-      b.data[i - blockAddrBegin] = this->lowerCache->getByte(i, cycles);
-  }
-
-  // Find replace block
   uint32_t id = this->getId(addr);
-  uint32_t blockIdBegin = id * this->policy.associativity;
-  uint32_t blockIdEnd = (id + 1) * this->policy.associativity;
-  uint32_t replaceId = this->getReplacementBlockId(blockIdBegin, blockIdEnd);
-  Block replaceBlock = this->blocks[replaceId];
-  if (this->writeBack && replaceBlock.valid &&
-      replaceBlock.modified) { // write back to memory
-    this->writeBlockToLowerLevel(replaceBlock);
-    this->statistics.totalCycles += this->policy.missLatency;
+  Victim victim;
+  uint32_t replaceId = this->evictLine(id, isPrefetch, &victim);
+  uint8_t *line = this->getLineData(replaceId);
+
+  // A non-blocking cache starts the fill once an MSHR is free. A line
+  // evicted while it was still arriving waits for that fill instead. Stores
+  // to the line still in the write buffer have to reach the lower level
+  // before it is read.
+  uint64_t start = std::max(cycle, this->flushWriteBuffer(blockAddrBegin));
+  MSHR *mshr = nullptr;
+  bool merged = false;
+  if (!this->mshrs.empty()) {
+    mshr = this->findMSHR(blockAddrBegin, start);
+    if (mshr != nullptr) {
+      merged = true;
+      this->statistics.numMSHRMerge++;
+    } else {
+      mshr = this->getFreeMSHR();
+      if (mshr->ready > start) {
+        this->statistics.numMSHRFull++;
+        start = mshr->ready;
+      }
+    }
+  }
+
+  // Fill the line from memory or the lower level cache. The lower levels
+  // count it as held here while it is on its way.
+  this->fillLine = blockAddrBegin;
+  this->filling = true;
+  uint64_t ready = this->readFromLowerLevel(blockAddrBegin, blockSize, line,
+                                            start, 0, true);
+  this->filling = false;
+  bool fillDirty =
+      this->lowerCache != nullptr && this->lowerCache->lastFillDirty;
+  this->lastAccessDepth = this->lowerCache == nullptr
+                              ? 1
+                              : 1 + this->lowerCache->lastAccessDepth;
+  if (merged) {
+    ready = mshr->ready;
+  }
+  // The miss is done once the victim has been written back, or taken in by
+  // an exclusive lower level, as well
+  uint64_t released = this->releaseVictim(victim, ready);
+  if (!this->policy.flatLatency) {
+    ready = released;
+  }
+  if (mshr != nullptr && !merged) {
+    mshr->line = blockAddrBegin;
+    mshr->ready = ready;
+    this->statistics.missCycles += ready - start;
+    if (start >= this->missActiveEnd) {
+      this->statistics.missActiveCycles += ready - start;
+    } else if (ready > this->missActiveEnd) {
+      this->statistics.missActiveCycles += ready - this->missActiveEnd;
+    }
+    if (ready > this->missActiveEnd) {
+      this->missActiveEnd = ready;
+    }
+  }
+  this->lastTiming.accept = start;
+  this->lastTiming.ready = ready;
+
+  this->valid[replaceId] = true;
+  this->modified[replaceId] = fillDirty;
+  this->tags[replaceId] = this->getTag(addr);
+  if (this->prefetcher != nullptr) {
+    this->prefetched[replaceId] = isPrefetch;
+    if (isPrefetch) {
+      this->prefetchReady[replaceId] = ready;
+    }
+  }
+  // Prefetched lines do not train the bypass predictor
+  if (this->bypassPredictor != nullptr) {
+    this->fillPC[replaceId] = this->accessPC;
+    this->reused[replaceId] = isPrefetch;
+  }
+  this->replacement->insert(id, replaceId - id * this->policy.associativity);
+  return replaceId;
+}
+
+// Frees a way of set id for a new line. An inclusive level first removes
+// the victim from the levels above, and takes their dirty data. A victim
+// that is dirty, or that goes to an exclusive lower level, is parked in the
+// victim buffer so the new line can be filled in place before releaseVictim
+// sends it down.
+uint32_t Cache::evictLine(uint32_t id, bool isPrefetch, Victim *victim) {
+  uint32_t replaceId = this->getReplacementBlockId(id);
+  victim->pending = false;
+  victim->dirty = false;
+  victim->addr = this->getAddr(replaceId);
+  if (!this->valid[replaceId]) {
+    return replaceId;
+  }
+  this->valid[replaceId] = false;
+
+  uint8_t *line = this->getLineData(replaceId);
+  if (this->policy.inclusion == INCLUSIVE) {
+    for (Cache *upper : this->upperCaches) {
+      if (upper->backInvalidate(victim->addr, line)) {
+        victim->dirty = true;
+      }
+    }
+  }
+  if (this->writeBack && this->modified[replaceId]) {
+    victim->dirty = true;
+  }
+  victim->pending = victim->dirty || this->isExclusiveBelow();
+  if (victim->pending) {
+    memcpy(this->victimBuffer, line, this->policy.blockSize);
+    this->pendingVictim = victim;
+  }
+
+  if (this->prefetcher != nullptr && this->prefetched[replaceId]) {
+    this->statistics.numPrefetchUnused++;
+  }
+  if (isPrefetch) {
+    uint32_t slot = this->getPollutionSlot(victim->addr);
+    this->pollutionTags[slot] = victim->addr >> this->offsetBits;
+    this->pollutionValid[slot] = true;
+  }
+  if (this->bypassPredictor != nullptr && !this->reused[replaceId]) {
+    this->bypassPredictor->recordDeadEviction(this->fillPC[replaceId]);
+  }
+  return replaceId;
+}
+
+// Sends the victim in the victim buffer to the lower level from cycle, and
+// returns the cycle it is there
+uint64_t Cache::releaseVictim(const Victim &victim, uint64_t cycle) {
+  this->pendingVictim = nullptr;
+  if (!victim.pending) {
+    return cycle;
+  }
+  if (this->isExclusiveBelow()) {
+    // The copy of a timing-only level may be stale. It is only kept when no
+    // other cache holds the line, and with the newest data from below.
+    if (this->timingOnly) {
+      if (this->lowerCache->isHeldAbove(victim.addr)) {
+        return cycle;
+      }
+      for (Cache *c = this->lowerCache; c != nullptr; c = c->lowerCache) {
+        if (c->inCache(victim.addr)) {
+          return cycle;
+        }
+      }
+      this->lowerCache->peekBlock(victim.addr, this->policy.blockSize,
+                                  this->victimBuffer);
+    }
+    return this->lowerCache->insertVictim(victim.addr, this->victimBuffer,
+                                          victim.dirty, cycle);
+  }
+  return this->writeToLowerLevel(victim.addr, this->policy.blockSize,
+                                 this->victimBuffer, cycle);
+}
+
+// An exclusive level takes in a line evicted from the level above at cycle,
+// clean or dirty. Returns the cycle it is in place. The line may be here
+// already if another level above held it as well.
+uint64_t Cache::insertVictim(uint32_t addr, const uint8_t *src, bool dirty,
+                             uint64_t cycle) {
+  this->statistics.numVictimInsert++;
+  uint64_t ready = cycle + this->policy.hitLatency;
+  int blockId = this->getBlockId(addr);
+  if (blockId != -1) {
+    if (dirty) {
+      memcpy(this->getLineData(blockId), src, this->policy.blockSize);
+      this->modified[blockId] = true;
+    }
+    return ready;
+  }
+
+  uint32_t id = this->getId(addr);
+  Victim victim;
+  uint32_t replaceId = this->evictLine(id, false, &victim);
+  memcpy(this->getLineData(replaceId), src, this->policy.blockSize);
+  this->valid[replaceId] = true;
+  this->modified[replaceId] = dirty;
+  this->tags[replaceId] = this->getTag(addr);
+  if (this->prefetcher != nullptr) {
+    this->prefetched[replaceId] = false;
+  }
+  if (this->bypassPredictor != nullptr) {
+    this->fillPC[replaceId] = this->accessPC;
+    this->reused[replaceId] = false;
+  }
+  this->replacement->insert(id, replaceId - id * this->policy.associativity);
+  return this->releaseVictim(victim, ready);
+}
+
+// An inclusive lower level evicts the line, so this level and the ones
+// above it drop their copies. Dirty data is copied to data, the upper
+// levels last as theirs is newer. Returns whether there was any. A victim
+// of this level not released yet is dropped as well, the lower level may
+// evict it while this level fills its replacement.
+bool Cache::backInvalidate(uint32_t addr, uint8_t *data) {
+  bool dirty = false;
+  Victim *victim = this->pendingVictim;
+  if (victim != nullptr && victim->pending && victim->addr == addr) {
+    this->statistics.numBackInvalidate++;
+    if (victim->dirty) {
+      memcpy(data, this->victimBuffer, this->policy.blockSize);
+      dirty = true;
+    }
+    victim->pending = false;
+  }
+  int blockId = this->getBlockId(addr);
+  if (blockId != -1) {
+    this->statistics.numBackInvalidate++;
+    if (this->writeBack && this->modified[blockId]) {
+      memcpy(data, this->getLineData(blockId), this->policy.blockSize);
+      dirty = true;
+    }
+    if (this->prefetcher != nullptr && this->prefetched[blockId]) {
+      this->statistics.numPrefetchUnused++;
+    }
+    this->valid[blockId] = false;
+  }
+  for (Cache *upper : this->upperCaches) {
+    if (upper->backInvalidate(addr, data)) {
+      dirty = true;
+    }
   }
+  return dirty;
+}
+
+// An exclusive level hands the line to the upper level that missed on it
+// at cycle. Returns the cycle it has left.
+uint64_t Cache::moveLineUp(uint32_t blockId, uint64_t cycle) {
+  this->valid[blockId] = false;
+  if (this->writeBack && this->modified[blockId]) {
+    return this->passDirtyUp(this->getAddr(blockId),
+                             this->getLineData(blockId), cycle);
+  }
+  return cycle;
+}
+
+// The line moving up through an exclusive level is dirty. It stays dirty
+// above if the only level above whose data is read takes it, and writes it
+// back later. Otherwise another level above could miss on it and read
+// stale data from below, so it is written back first. Timing-only levels
+// never supply data, but one taking the line cannot keep it dirty.
+uint64_t Cache::passDirtyUp(uint32_t addr, const uint8_t *src,
+                            uint64_t cycle) {
+  Cache *owner = nullptr;
+  uint32_t readers = 0;
+  bool toTimingOnly = false;
+  for (Cache *upper : this->upperCaches) {
+    if (upper->timingOnly) {
+      uint32_t line = addr & ~(upper->policy.blockSize - 1);
+      toTimingOnly |= upper->filling && upper->fillLine == line;
+    } else {
+      owner = upper;
+      readers++;
+    }
+  }
+  if (readers == 1 && owner->writeBack && !toTimingOnly) {
+    this->lastFillDirty = true;
+    return cycle;
+  }
+  return this->writeToLowerLevel(addr, this->policy.blockSize, src, cycle);
+}
+
+// Lines being filled into a level above, or evicted from it and not
+// released yet, count as held there
+bool Cache::isHeldAbove(uint32_t addr) {
+  for (Cache *upper : this->upperCaches) {
+    uint32_t line = addr & ~(upper->policy.blockSize - 1);
+    Victim *victim = upper->pendingVictim;
+    if (upper->inCache(addr) || (upper->filling && upper->fillLine == line) ||
+        (victim != nullptr && victim->pending && victim->addr == line) ||
+        upper->isHeldAbove(addr)) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  this->blocks[replaceId] = b;
+bool Cache::isExclusiveBelow() {
+  return this->lowerCache != nullptr &&
+         this->lowerCache->policy.inclusion == EXCLUSIVE;
 }
 
-uint32_t Cache::getReplacementBlockId(uint32_t begin, uint32_t end) {
+uint32_t Cache::getReplacementBlockId(uint32_t id) {
   // Find invalid block first
+  uint32_t begin = id * this->policy.associativity;
+  uint32_t end = begin + this->policy.associativity;
   for (uint32_t i = begin; i < end; ++i) {
-    if (!this->blocks[i].valid)
+    if (!this->valid[i])
       return i;
   }
 
-  // Otherwise use LRU
-  uint32_t resultId = begin;
-  uint32_t min = this->blocks[begin].lastReference;
-  for (uint32_t i = begin; i < end; ++i) {
-    if (this->blocks[i].lastReference < min) {
-      resultId = i;
-      min = this->blocks[i].lastReference;
-    }
+  // Otherwise ask the replacement policy
+  return begin + this->replacement->getVictim(id);
+}
+
+// Transfers len bytes from or to the lower level, or memory behind the last
+// level, starting at cycle. Both return the cycle the transfer completes.
+// bypassLevels is passed on to the lower level with setAccessInfo, and a
+// fill of this level takes the line from an exclusive lower level.
+uint64_t Cache::readFromLowerLevel(uint32_t addr, uint32_t len, uint8_t *dst,
+                                   uint64_t cycle, uint32_t bypassLevels,
+                                   bool isFill) {
+  if (this->lowerCache == nullptr) {
+    this->memory->readBlockNoCache(addr, len, dst);
+    return cycle + this->policy.missLatency;
+  }
+  this->lowerCache->setAccessInfo(this->accessPC, cycle, bypassLevels);
+  this->lowerCache->upperFill = isFill;
+  this->lowerCache->readBlock(addr, len, dst);
+  this->lowerCache->upperFill = false;
+  // A flat miss waits only for the lookup below, and for an MSHR there
+  if (this->policy.flatLatency) {
+    return std::max(cycle + this->lowerCache->policy.hitLatency,
+                    this->lowerCache->lastTiming.accept);
   }
-  return resultId;
+  return this->lowerCache->lastTiming.ready;
 }
 
-void Cache::writeBlockToLowerLevel(Cache::Block &b) {
-  uint32_t addrBegin = this->getAddr(b);
+uint64_t Cache::writeToLowerLevel(uint32_t addr, uint32_t len,
+                                  const uint8_t *src, uint64_t cycle,
+                                  uint32_t bypassLevels) {
   if (this->lowerCache == nullptr) {
-    for (uint32_t i = 0; i < b.size; ++i) {
-      this->memory->setByteNoCache(addrBegin + i, b.data[i]);
+    this->memory->writeBlockNoCache(addr, len, src);
+    return this->policy.flatLatency ? cycle
+                                    : cycle + this->policy.missLatency;
+  }
+  this->lowerCache->setAccessInfo(this->accessPC, cycle, bypassLevels);
+  this->lowerCache->writeBlock(addr, len, src);
+  return this->policy.flatLatency ? cycle
+                                  : this->lowerCache->lastTiming.ready;
+}
+
+// Puts a store to the lower level in the write buffer at cycle, merging it
+// into a waiting entry of the same line if there is one. Returns the cycle
+// the store leaves this level, later than cycle only if the buffer was full.
+uint64_t Cache::bufferWrite(uint32_t addr, uint32_t len, const uint8_t *src,
+                            uint64_t cycle) {
+  uint32_t blockSize = this->policy.blockSize;
+  uint32_t line = addr & ~(blockSize - 1);
+  this->drainWriteBuffer(cycle);
+
+  WriteBufferEntry *target = nullptr;
+  for (uint32_t i = this->writeBufferCount; i > 0; --i) {
+    WriteBufferEntry &entry = this->getWriteBufferEntry(i - 1);
+    if (entry.line == line) {
+      if (!entry.draining) {
+        target = &entry;
+        this->statistics.numWriteCombine++;
+      }
+      break;
     }
-  } else {
-    for (uint32_t i = 0; i < b.size; ++i) {
-      this->lowerCache->setByte(addrBegin + i, b.data[i]);
+  }
+  if (target == nullptr) {
+    if (this->writeBufferCount == this->writeBuffer.size()) {
+      this->statistics.numWriteBufferFull++;
+      WriteBufferEntry &oldest = this->getWriteBufferEntry(0);
+      if (!oldest.draining) {
+        this->drainWriteBufferEntry(
+            oldest, std::max(oldest.enqueue, this->writeBufferFree));
+      }
+      cycle = std::max(cycle, oldest.drainEnd);
+      this->drainWriteBuffer(cycle);
     }
+    target = &this->getWriteBufferEntry(this->writeBufferCount);
+    this->writeBufferCount++;
+    target->line = line;
+    target->enqueue = cycle;
+    target->draining = false;
+    target->drainEnd = 0;
+    target->dirtyBegin = blockSize;
+    target->dirtyEnd = 0;
   }
+
+  uint32_t offset = this->getOffset(addr);
+  size_t base = size_t(target - &this->writeBuffer[0]) * blockSize + offset;
+  memcpy(&this->writeBufferData[base], src, len);
+  memset(&this->writeBufferMask[base], 1, len);
+  target->dirtyBegin = std::min(target->dirtyBegin, offset);
+  target->dirtyEnd = std::max(target->dirtyEnd, offset + len);
+  return cycle;
+}
+
+// Advances the write buffer to cycle. The lower level takes one entry at a
+// time in order, each as soon as it is free, and an entry leaves the buffer
+// once its drain has completed.
+void Cache::drainWriteBuffer(uint64_t cycle) {
+  for (uint32_t i = 0; i < this->writeBufferCount; ++i) {
+    WriteBufferEntry &entry = this->getWriteBufferEntry(i);
+    if (entry.draining) {
+      continue;
+    }
+    uint64_t start = std::max(entry.enqueue, this->writeBufferFree);
+    if (start > cycle) {
+      break;
+    }
+    this->drainWriteBufferEntry(entry, start);
+  }
+  while (this->writeBufferCount > 0) {
+    WriteBufferEntry &oldest = this->getWriteBufferEntry(0);
+    if (!oldest.draining || oldest.drainEnd > cycle) {
+      break;
+    }
+    this->writeBufferHead =
+        (this->writeBufferHead + 1) % this->writeBuffer.size();
+    this->writeBufferCount--;
+  }
+}
+
+// Drains the buffered stores to the line right away, with the entries ahead
+// of them. Returns the cycle they are all in the lower level, 0 if there
+// were none.
+uint64_t Cache::flushWriteBuffer(uint32_t line) {
+  uint32_t last = this->writeBufferCount;
+  for (uint32_t i = 0; i < this->writeBufferCount; ++i) {
+    if (this->getWriteBufferEntry(i).line == line) {
+      last = i;
+    }
+  }
+  if (last == this->writeBufferCount) {
+    return 0;
+  }
+  for (uint32_t i = 0; i <= last; ++i) {
+    WriteBufferEntry &entry = this->getWriteBufferEntry(i);
+    if (!entry.draining) {
+      this->drainWriteBufferEntry(
+          entry, std::max(entry.enqueue, this->writeBufferFree));
+    }
+  }
+  return this->getWriteBufferEntry(last).drainEnd;
+}
+
+// Writes each run of written bytes of the entry to the lower level, one
+// after another from start
+void Cache::drainWriteBufferEntry(WriteBufferEntry &entry, uint64_t start) {
+  size_t base = size_t(&entry - &this->writeBuffer[0]) * this->policy.blockSize;
+  uint8_t *mask = &this->writeBufferMask[base];
+  uint64_t ready = start;
+  uint32_t i = entry.dirtyBegin;
+  while (i < entry.dirtyEnd) {
+    if (!mask[i]) {
+      ++i;
+      continue;
+    }
+    uint32_t runBegin = i;
+    while (i < entry.dirtyEnd && mask[i]) {
+      mask[i++] = 0;
+    }
+    ready = this->writeToLowerLevel(entry.line + runBegin, i - runBegin,
+                                    &this->writeBufferData[base + runBegin],
+                                    ready);
+  }
+  entry.draining = true;
+  entry.drainEnd = ready;
+  this->writeBufferFree = ready;
+}
+
+Cache::WriteBufferEntry &Cache::getWriteBufferEntry(uint32_t i) {
+  return this->writeBuffer[(this->writeBufferHead + i) %
+                           this->writeBuffer.size()];
 }
 
 bool Cache::isPowerOfTwo(uint32_t n) { return n > 0 && (n & (n - 1)) == 0; }
@@ -289,27 +1234,49 @@ uint32_t Cache::log2i(uint32_t val) {
 }
 
 uint32_t Cache::getTag(uint32_t addr) {
-  uint32_t offsetBits = log2i(policy.blockSize);
-  uint32_t idBits = log2i(policy.blockNum / policy.associativity);
-  uint32_t mask = (1 << (32 - offsetBits - idBits)) - 1;
-  return (addr >> (offsetBits + idBits)) & mask;
+  return uint64_t(addr) >> (this->offsetBits + this->setBits);
 }
 
 uint32_t Cache::getId(uint32_t addr) {
-  uint32_t offsetBits = log2i(policy.blockSize);
-  uint32_t idBits = log2i(policy.blockNum / policy.associativity);
-  uint32_t mask = (1 << idBits) - 1;
-  return (addr >> offsetBits) & mask;
+  return (addr >> this->offsetBits) & ((1 << this->setBits) - 1);
 }
 
 uint32_t Cache::getOffset(uint32_t addr) {
-  uint32_t bits = log2i(policy.blockSize);
-  uint32_t mask = (1 << bits) - 1;
-  return addr & mask;
+  return addr & (this->policy.blockSize - 1);
+}
+
+uint32_t Cache::getAddr(uint32_t blockId) {
+  uint32_t id = blockId / this->policy.associativity;
+  return (this->tags[blockId] << (this->offsetBits + this->setBits)) |
+         (id << this->offsetBits);
 }
 
-uint32_t Cache::getAddr(Cache::Block &b) {
-  uint32_t offsetBits = log2i(policy.blockSize);
-  uint32_t idBits = log2i(policy.blockNum / policy.associativity);
-  return (b.tag << (offsetBits + idBits)) | (b.id << offsetBits);
-}
\ No newline at end of file
+uint32_t Cache::getPollutionSlot(uint32_t addr) {
+  return (addr >> this->offsetBits) & (this->policy.blockNum - 1);
+}
+
+// The MSHR still filling the line at the given cycle, if any
+Cache::MSHR *Cache::findMSHR(uint32_t line, uint64_t cycle) {
+  for (MSHR &mshr : this->mshrs) {
+    if (mshr.line == line && mshr.ready > cycle) {
+      return &mshr;
+    }
+  }
+  return nullptr;
+}
+
+// The MSHR that frees up first, it is free already if its ready cycle has
+// passed
+Cache::MSHR *Cache::getFreeMSHR() {
+  MSHR *first = &this->mshrs[0];
+  for (MSHR &mshr : this->mshrs) {
+    if (mshr.ready < first->ready) {
+      first = &mshr;
+    }
+  }
+  return first;
+}
+
+uint8_t *Cache::getLineData(uint32_t blockId) {
+  return this->data + size_t(blockId) * this->policy.blockSize;
+}
@@ -8,38 +8,61 @@
 #define CACHE_H
 
 #include <cstdint>
+#include <cstdio>
 #include <vector>
 
+#include "BypassPredictor.h"
 #include "MemoryManager.h"
+#include "Prefetcher.h"
+#include "ReplacementPolicy.h"
 
 class MemoryManager;
 
 class Cache {
 public:
+  // What a level holds relative to the levels above it
+  enum Inclusion {
+    NINE = 0,  // neither inclusive nor exclusive, clean lines evicted above
+               // are dropped
+    INCLUSIVE, // every line above is held here as well, evicting a line
+               // invalidates it above
+    EXCLUSIVE, // no line above is held here, a miss above moves the line up
+               // and every line evicted above is kept here
+    INCLUSION_NUM,
+  };
+
+  // Accepts the names returned by getInclusionName, case insensitive
+  static bool parseInclusion(const char *name, Inclusion *inclusion);
+  static const char *getInclusionName(Inclusion inclusion);
+
   struct Policy {
     // In bytes, must be power of 2
     uint32_t cacheSize;
     uint32_t blockSize;
     uint32_t blockNum;
     uint32_t associativity;
-    uint32_t hitLatency;  // in cycles
-    uint32_t missLatency; // in cycles
-  };
-
-  struct Block {
-    bool valid;
-    bool modified;
-    uint32_t tag;
-    uint32_t id;
-    uint32_t size;
-    uint32_t lastReference;
-    std::vector<uint8_t> data;
-    Block() {}
-    Block(const Block &b)
-        : valid(b.valid), modified(b.modified), tag(b.tag), id(b.id),
-          size(b.size) {
-      data = b.data;
-    }
+    // In cycles. A miss costs the hit latency plus whatever the lower levels
+    // take, missLatency is the latency of memory behind the last level and
+    // unused by the others.
+    uint32_t hitLatency;
+    uint32_t missLatency;
+    // The cost model of the original simulator instead: a miss costs the
+    // hit latency of the level below, or missLatency at the last level,
+    // writebacks and write-through writes are free, and an access that
+    // spans lines costs what its first line does
+    bool flatLatency;
+    ReplacementPolicy::Kind replacement;
+    Prefetcher::Kind prefetcher;
+    uint32_t mshrNum; // outstanding misses, 0 for a blocking cache
+    // Lines of stores on their way to the lower level, 0 to write them
+    // through synchronously
+    uint32_t writeBufferSize;
+    // Misses a PC-based reuse predictor expects not to be hit again skip
+    // this level
+    bool predictBypass;
+    // Towards the levels above, unused by the first level. Inclusive and
+    // exclusive levels need the block size of the levels above.
+    Inclusion inclusion;
   };
 
   struct Statistics {
@@ -47,35 +70,229 @@ public:
     uint32_t numWrite;
     uint32_t numHit;
     uint32_t numMiss;
-    uint64_t totalCycles;
+    uint64_t totalCycles; // sum of the access latencies, for the AMAT
+    // Lines prefetched, and how they ended: used after they arrived, used
+    // while still on their way, evicted unused, or evicting a line that
+    // then missed before the prefetched line was used
+    uint32_t numPrefetch;
+    uint32_t numPrefetchUseful;
+    uint32_t numPrefetchLate;
+    uint32_t numPrefetchUnused;
+    uint32_t numPrefetchPolluting;
+    // Non-blocking caches only: secondary misses merged into the MSHR of a
+    // line still being filled, misses that waited for a free MSHR, the sum
+    // of the miss durations and the cycles with at least one miss
+    // outstanding. Their ratio is the memory-level parallelism.
+    uint32_t numMSHRMerge;
+    uint32_t numMSHRFull;
+    uint64_t missCycles;
+    uint64_t missActiveCycles;
+    // With a write buffer: stores merged into a line already waiting in it,
+    // and stores that found it full and waited for its oldest line to drain
+    uint32_t numWriteCombine;
+    uint32_t numWriteBufferFull;
+    uint32_t numBypass; // misses served without allocating a line
+    // Lines invalidated because an inclusive lower level evicted them, and
+    // lines evicted above that an exclusive level took in
+    uint32_t numBackInvalidate;
+    uint32_t numVictimInsert;
+    // Writes an exclusive level passed down because the line is held
+    // above, such as the writeback of a dirty line moving up. They are
+    // neither hits nor misses here.
+    uint32_t numPassThrough;
+  };
+
+  // Timing of an access in absolute cycles, it is issued at the cycle given
+  // to setAccessInfo
+  struct Timing {
+    uint64_t accept; // an MSHR took the request, later than the issue cycle
+                     // only when all of them were busy
+    uint64_t ready;  // the data is available
   };
 
   Cache(MemoryManager *manager, Policy policy, Cache *lowerCache = nullptr,
         bool writeBack = true, bool writeAllocate = true);
+  ~Cache();
+  Cache(const Cache &) = delete;
+  Cache &operator=(const Cache &) = delete;
 
   bool inCache(uint32_t addr);
   uint32_t getBlockId(uint32_t addr);
   uint8_t getByte(uint32_t addr, uint32_t *cycles = nullptr);
   void setByte(uint32_t addr, uint8_t val, uint32_t *cycles = nullptr);
 
+  // Little-endian access of len (1, 2 or 4) bytes. Each access makes one
+  // lookup per cache line it touches, one after another, and *cycles is
+  // the latency of all of them.
+  uint32_t read(uint32_t addr, uint32_t len, uint32_t *cycles = nullptr);
+  void write(uint32_t addr, uint32_t len, uint32_t val,
+             uint32_t *cycles = nullptr);
+
+  // Arbitrary length accesses, used by upper levels for fills and writebacks
+  void readBlock(uint32_t addr, uint32_t len, uint8_t *data,
+                 uint32_t *cycles = nullptr);
+  void writeBlock(uint32_t addr, uint32_t len, const uint8_t *data,
+                  uint32_t *cycles = nullptr);
+  // Reads the newest copy of the data, from the highest level holding it,
+  // without touching statistics or replacement state
+  void peekBlock(uint32_t addr, uint32_t len, uint8_t *data);
+
   void printInfo(bool verbose);
   void printStatistics();
+  // How far below this level the last access had to go, 0 for a hit here
+  // and getLevelNum() when it was served by memory
+  uint32_t getLastAccessDepth();
+  // When the last access was accepted and completed. With MSHRs, misses
+  // overlap and the requester only has to wait for the data it uses.
+  Timing getLastTiming();
+  bool isNonBlocking();
+  // Number of cache levels from this one down
+  uint32_t getLevelNum();
+  Cache *getLowerCache();
+  ReplacementPolicy *getReplacementPolicy();
+  // PC and cycle of the demand accesses that follow, for this and the lower
+  // levels. Prefetchers train on the PC, and a prefetched line used before
+  // its fill latency has passed counts as late and costs the rest of it.
+  // Misses in the first bypassLevels levels from this one down do not
+  // allocate a line, for data without temporal locality.
+  void setAccessInfo(uint32_t pc, uint64_t cycle, uint32_t bypassLevels = 0);
+  // Gives OPT replacement the next use of every line access this cache will
+  // make from now on, see OPTPolicy::computeNextUse
+  void setNextUse(const std::vector<uint32_t> *nextUse);
+  // The data of this level is never read, only its timing is used, as for
+  // an instruction cache whose fetches read the data cache. Lower levels
+  // do not keep it coherent.
+  void setTimingOnly();
+
+  // Clears the statistics of this level and all lower levels, cache
+  // contents are kept
+  void resetStatistics();
+
+  // Copies the dirty lines of this and all lower levels into memory
+  // without cleaning them, so memory holds the architectural state
+  void syncMemory();
+  // Line state of this level followed by the lower levels, for checkpoints.
+  // A cache sharing its lower levels with another one saves only its own.
+  bool saveState(FILE *file, bool lowerLevels = true);
+  bool loadState(FILE *file, bool lowerLevels = true);
 
   Statistics statistics;
 
 private:
-  uint32_t referenceCounter;
+  // Miss status holding registers, the line being filled and the cycle
+  // the fill completes, free once that cycle has passed
+  struct MSHR {
+    uint32_t line;
+    uint64_t ready;
+  };
+
+  // A line evicted to make room for a fill. If it has to go to the lower
+  // level it waits in the victim buffer until the fill is done.
+  struct Victim {
+    bool pending;
+    bool dirty;
+    uint32_t addr;
+  };
+
+  // A line of the write buffer, its data and byte mask are in
+  // writeBufferData and writeBufferMask. Stores merge into it until it
+  // starts draining, and it keeps its slot until the drain completes.
+  struct WriteBufferEntry {
+    uint32_t line;
+    uint64_t enqueue;
+    bool draining;
+    uint64_t drainEnd;
+    uint32_t dirtyBegin; // range of offsets holding written bytes
+    uint32_t dirtyEnd;
+  };
+
+  uint32_t lastAccessDepth;
+  Timing lastTiming;
   bool writeBack;     // default true
   bool writeAllocate; // default true
   MemoryManager *memory;
   Cache *lowerCache;
+  std::vector<Cache *> upperCaches; // the levels with this one below them
+  // The access is a fill of an upper level, and the line it moves up from
+  // an exclusive level is dirty
+  bool upperFill;
+  bool lastFillDirty;
+  bool timingOnly;
+  Victim *pendingVictim; // between evictLine and releaseVictim
+  bool filling;           // fillLine is being read from the lower level
+  uint32_t fillLine;
   Policy policy;
-  std::vector<Block> blocks;
+  ReplacementPolicy *replacement;
+  OPTPolicy *optPolicy; // the replacement policy if it is OPT
+  Prefetcher *prefetcher; // nullptr without prefetching
+  BypassPredictor *bypassPredictor; // nullptr without predicted bypassing
+  std::vector<uint32_t> prefetchQueue;
+  std::vector<MSHR> mshrs; // empty for a blocking cache
+  uint64_t missActiveEnd;  // last cycle covered by missActiveCycles
+  // Circular FIFO of writeBufferSize entries, drained one at a time in order
+  std::vector<WriteBufferEntry> writeBuffer;
+  uint32_t writeBufferHead;
+  uint32_t writeBufferCount;
+  uint64_t writeBufferFree; // cycle the lower level takes the next drain
+  std::vector<uint8_t> writeBufferData; // blockSize bytes per entry
+  std::vector<uint8_t> writeBufferMask;
+  uint32_t accessPC;
+  uint64_t accessCycle;
+  uint32_t accessBypass;
+  uint32_t offsetBits;
+  uint32_t setBits;
+
+  // Line state in structure-of-arrays form, indexed by line number
+  // (set * associativity + way)
+  std::vector<uint32_t> tags;
+  std::vector<uint8_t> valid;
+  std::vector<uint8_t> modified;
+  // Prefetched and not used yet, and the cycle the prefetch completes,
+  // these and the pollution table are only allocated with a prefetcher
+  std::vector<uint8_t> prefetched;
+  std::vector<uint64_t> prefetchReady;
+  // Lines evicted by prefetches, direct mapped by line address, a demand
+  // miss on one of them is blamed on the prefetch
+  std::vector<uint32_t> pollutionTags;
+  std::vector<uint8_t> pollutionValid;
+  // With a bypass predictor, the PC of the miss that filled each line and
+  // whether the line has been hit since
+  std::vector<uint32_t> fillPC;
+  std::vector<uint8_t> reused;
+  // Line data, blockSize bytes per line, aligned to host cache lines
+  uint8_t *data;
+  // Holds a dirty victim while its replacement is filled in place
+  uint8_t *victimBuffer;
 
   void initCache();
-  void loadBlockFromLowerLevel(uint32_t addr, uint32_t *cycles = nullptr);
-  uint32_t getReplacementBlockId(uint32_t begin, uint32_t end);
-  void writeBlockToLowerLevel(Block &b);
+  void accessBlock(uint32_t addr, uint32_t len, uint8_t *data, bool isWrite,
+                   uint32_t *cycles);
+  Prefetcher::Outcome accessLine(uint32_t addr, uint32_t len, uint8_t *data,
+                                 bool isWrite);
+  void issuePrefetches(uint32_t addr, Prefetcher::Outcome outcome);
+  uint32_t loadBlockFromLowerLevel(uint32_t addr, uint64_t cycle,
+                                   bool isPrefetch = false);
+  uint32_t evictLine(uint32_t id, bool isPrefetch, Victim *victim);
+  uint64_t releaseVictim(const Victim &victim, uint64_t cycle);
+  uint64_t insertVictim(uint32_t addr, const uint8_t *src, bool dirty,
+                        uint64_t cycle);
+  bool backInvalidate(uint32_t addr, uint8_t *data);
+  uint64_t moveLineUp(uint32_t blockId, uint64_t cycle);
+  uint64_t passDirtyUp(uint32_t addr, const uint8_t *src, uint64_t cycle);
+  bool isHeldAbove(uint32_t addr);
+  bool isExclusiveBelow();
+  uint32_t getReplacementBlockId(uint32_t id);
+  uint64_t readFromLowerLevel(uint32_t addr, uint32_t len, uint8_t *dst,
+                              uint64_t cycle, uint32_t bypassLevels = 0,
+                              bool isFill = false);
+  uint64_t writeToLowerLevel(uint32_t addr, uint32_t len, const uint8_t *src,
+                             uint64_t cycle, uint32_t bypassLevels = 0);
+  uint64_t bufferWrite(uint32_t addr, uint32_t len, const uint8_t *src,
+                       uint64_t cycle);
+  void drainWriteBuffer(uint64_t cycle);
+  uint64_t flushWriteBuffer(uint32_t line);
+  void drainWriteBufferEntry(WriteBufferEntry &entry, uint64_t start);
+  WriteBufferEntry &getWriteBufferEntry(uint32_t i);
 
   // Utility Functions
   bool isPolicyValid();
@@ -84,7 +301,11 @@ private:
   uint32_t getTag(uint32_t addr);
   uint32_t getId(uint32_t addr);
   uint32_t getOffset(uint32_t addr);
-  uint32_t getAddr(Block &b);
+  uint32_t getAddr(uint32_t blockId);
+  uint8_t *getLineData(uint32_t blockId);
+  uint32_t getPollutionSlot(uint32_t addr);
+  MSHR *findMSHR(uint32_t line, uint64_t cycle);
+  MSHR *getFreeMSHR();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,253 @@
+/*
+ * Randomized consistency check of the cache hierarchy
+ *
+ * Runs random reads and writes through a three-level hierarchy for every
+ * combination of L2 and L3 inclusion policy, with a write-back or a
+ * write-through L1, and with or without a timing-only instruction cache
+ * beside it. Every level prefetches, has MSHRs, and some accesses carry
+ * bypass hints. It checks that
+ *   - every read returns the last value written,
+ *   - peekBlock sees the newest data,
+ *   - inclusive levels hold every line above them and exclusive levels
+ *     none of the lines of the data cache above them,
+ *   - syncMemory leaves memory with the newest data.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "Cache.h"
+#include "MemoryManager.h"
+
+bool parseParameters(int argc, char **argv);
+void printUsage();
+bool checkHierarchy(Cache::Inclusion l2Inclusion,
+                    Cache::Inclusion l3Inclusion, bool writeThrough,
+                    bool instCache);
+bool checkInclusion(Cache *l1, Cache *l1i, Cache *l2, Cache *l3,
+                    Cache::Inclusion l2Inclusion,
+                    Cache::Inclusion l3Inclusion);
+Cache::Policy makePolicy(uint32_t cacheSize, uint32_t associativity,
+                         uint32_t hitLatency, uint32_t missLatency,
+                         Prefetcher::Kind prefetcher, uint32_t mshrNum);
+
+const uint32_t DATA_BASE = 0x100000;
+const uint32_t DATA_SIZE = 16384;
+const uint32_t CODE_BASE = 0x200000; // read-only, as seen by fetches
+const uint32_t CODE_SIZE = 2048;
+const uint32_t BLOCK_SIZE = 16;
+// Inclusion invariants are checked every CHECK_INTERVAL steps
+const uint32_t CHECK_INTERVAL = 1009;
+
+uint32_t seed = 1;
+uint32_t stepNum = 300000;
+
+int main(int argc, char **argv) {
+  if (!parseParameters(argc, argv)) {
+    printUsage();
+    return -1;
+  }
+  bool good = true;
+  for (int l2 = 0; l2 < Cache::INCLUSION_NUM; ++l2) {
+    for (int l3 = 0; l3 < Cache::INCLUSION_NUM; ++l3) {
+      for (int writeThrough = 0; writeThrough < 2; ++writeThrough) {
+        for (int instCache = 0; instCache < 2; ++instCache) {
+          if (!checkHierarchy(Cache::Inclusion(l2), Cache::Inclusion(l3),
+                              writeThrough, instCache)) {
+            good = false;
+          }
+        }
+      }
+    }
+  }
+  printf("%s\n", good ? "All hierarchies consistent" : "FAILED");
+  return good ? 0 : -1;
+}
+
+bool parseParameters(int argc, char **argv) {
+  // Read Parameters
+  if (argc > 3) {
+    return false;
+  }
+  if (argc > 1) {
+    char *end;
+    seed = strtoul(argv[1], &end, 10);
+    if (*end != '\0') {
+      return false;
+    }
+  }
+  if (argc > 2) {
+    char *end;
+    stepNum = strtoul(argv[2], &end, 10);
+    if (*end != '\0' || stepNum == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void printUsage() { printf("Usage: CacheCheck [seed] [steps]\n"); }
+
+bool checkHierarchy(Cache::Inclusion l2Inclusion,
+                    Cache::Inclusion l3Inclusion, bool writeThrough,
+                    bool instCache) {
+  MemoryManager memory;
+  Cache::Policy l3Policy =
+      makePolicy(2048, 4, 10, 50, Prefetcher::STRIDE, 2);
+  Cache::Policy l2Policy =
+      makePolicy(512, 2, 4, 20, Prefetcher::STREAM, 4);
+  Cache::Policy l1Policy =
+      makePolicy(128, 2, 1, 8, Prefetcher::NEXT_LINE, 4);
+  l3Policy.inclusion = l3Inclusion;
+  l3Policy.predictBypass = l3Inclusion != Cache::INCLUSIVE;
+  l2Policy.inclusion = l2Inclusion;
+  l2Policy.predictBypass = l2Inclusion != Cache::INCLUSIVE;
+  l1Policy.writeBufferSize = writeThrough ? 2 : 0;
+  Cache *l3 = new Cache(&memory, l3Policy);
+  Cache *l2 = new Cache(&memory, l2Policy, l3);
+  Cache *l1 = new Cache(&memory, l1Policy, l2, !writeThrough, true);
+  Cache *l1i = nullptr;
+  if (instCache) {
+    l1i = new Cache(&memory, l1Policy, l2);
+    l1i->setTimingOnly();
+  }
+  memory.setCache(l1);
+
+  std::vector<uint8_t> expected(DATA_SIZE, 0);
+  for (uint32_t i = 0; i < DATA_SIZE; ++i) {
+    memory.setByteNoCache(DATA_BASE + i, 0);
+  }
+  for (uint32_t i = 0; i < CODE_SIZE; ++i) {
+    memory.setByteNoCache(CODE_BASE + i, uint8_t(i * 7));
+  }
+
+  srand(seed);
+  uint64_t cycle = 0;
+  bool good = true;
+  for (uint32_t step = 0; step < stepNum && good; ++step) {
+    uint32_t offset = rand() % (DATA_SIZE - 4);
+    if (rand() % 4 == 0) { // a hot part
+      offset &= 1023;
+    }
+    uint32_t len = 1 << (rand() % 3);
+    l1->setAccessInfo(0x1000 + 4 * (rand() % 8), cycle,
+                      rand() % 8 == 0 ? rand() % 4 : 0);
+    int op = rand() % 6;
+    if (op < 2) {
+      uint32_t val = rand();
+      l1->write(DATA_BASE + offset, len, val);
+      for (uint32_t i = 0; i < len; ++i) {
+        expected[offset + i] = val >> (8 * i);
+      }
+    } else if (op < 4) {
+      uint32_t val = l1->read(DATA_BASE + offset, len);
+      uint32_t expectedVal = 0;
+      for (uint32_t i = 0; i < len; ++i) {
+        expectedVal |= uint32_t(expected[offset + i]) << (8 * i);
+      }
+      if (val != expectedVal) {
+        printf("Step %u: read 0x%x at 0x%x, expected 0x%x\n", step, val,
+               DATA_BASE + offset, expectedVal);
+        good = false;
+      }
+    } else if (op == 4) {
+      uint32_t offset = rand() % CODE_SIZE;
+      Cache *cache = l1i != nullptr && rand() % 2 ? l1i : l1;
+      cache->setAccessInfo(0x2000 + 4 * (rand() % 8), cycle,
+                           rand() % 8 == 0 ? rand() % 4 : 0);
+      uint8_t val = cache->read(CODE_BASE + offset, 1);
+      if (val != uint8_t(offset * 7)) {
+        printf("Step %u: read 0x%x at 0x%x, expected 0x%x\n", step, val,
+               CODE_BASE + offset, uint8_t(offset * 7));
+        good = false;
+      }
+    } else if (l1i != nullptr) {
+      // A fetch from data, the instruction cache may hold stale copies
+      l1i->setAccessInfo(0x3000, cycle);
+      l1i->read(DATA_BASE + (offset & ~3u), 4);
+    }
+    cycle = l1->getLastTiming().ready + 1;
+
+    if (good && step % CHECK_INTERVAL == 0) {
+      std::vector<uint8_t> data(DATA_SIZE);
+      l1->peekBlock(DATA_BASE, DATA_SIZE, data.data());
+      if (data != expected) {
+        printf("Step %u: peekBlock returned stale data\n", step);
+        good = false;
+      }
+      if (!checkInclusion(l1, l1i, l2, l3, l2Inclusion, l3Inclusion)) {
+        printf("Step %u: inclusion violated\n", step);
+        good = false;
+      }
+    }
+  }
+
+  l1->syncMemory();
+  std::vector<uint8_t> data(DATA_SIZE);
+  memory.readBlockNoCache(DATA_BASE, DATA_SIZE, data.data());
+  if (good && data != expected) {
+    printf("syncMemory left stale data\n");
+    good = false;
+  }
+  printf("L2 %-9s L3 %-9s %s L1%s: %s, L2 misses %u, L3 misses %u\n",
+         Cache::getInclusionName(l2Inclusion),
+         Cache::getInclusionName(l3Inclusion),
+         writeThrough ? "write-through" : "write-back   ",
+         instCache ? " and L1I" : "        ", good ? "ok" : "FAILED",
+         l2->statistics.numMiss, l3->statistics.numMiss);
+  delete l1i;
+  delete l1;
+  delete l2;
+  delete l3;
+  return good;
+}
+
+// The instruction cache may share lines with the other levels, its data is
+// never read
+bool checkInclusion(Cache *l1, Cache *l1i, Cache *l2, Cache *l3,
+                    Cache::Inclusion l2Inclusion,
+                    Cache::Inclusion l3Inclusion) {
+  for (uint32_t addr = DATA_BASE; addr < DATA_BASE + DATA_SIZE;
+       addr += BLOCK_SIZE) {
+    bool inL1 = l1->inCache(addr);
+    bool above = inL1 || (l1i != nullptr && l1i->inCache(addr));
+    bool inL2 = l2->inCache(addr);
+    bool inL3 = l3->inCache(addr);
+    if (l2Inclusion == Cache::INCLUSIVE && above && !inL2) {
+      return false;
+    }
+    if (l2Inclusion == Cache::EXCLUSIVE && inL1 && inL2) {
+      return false;
+    }
+    if (l3Inclusion == Cache::INCLUSIVE && (above || inL2) && !inL3) {
+      return false;
+    }
+    if (l3Inclusion == Cache::EXCLUSIVE && inL2 && inL3) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Cache::Policy makePolicy(uint32_t cacheSize, uint32_t associativity,
+                         uint32_t hitLatency, uint32_t missLatency,
+                         Prefetcher::Kind prefetcher, uint32_t mshrNum) {
+  Cache::Policy policy;
+  policy.cacheSize = cacheSize;
+  policy.blockSize = BLOCK_SIZE;
+  policy.blockNum = cacheSize / BLOCK_SIZE;
+  policy.associativity = associativity;
+  policy.hitLatency = hitLatency;
+  policy.missLatency = missLatency;
+  policy.flatLatency = false;
+  policy.replacement = ReplacementPolicy::LRU;
+  policy.prefetcher = prefetcher;
+  policy.mshrNum = mshrNum;
+  policy.writeBufferSize = 0;
+  policy.predictBypass = false;
+  policy.inclusion = Cache::NINE;
+  return policy;
+}
@@ -2,36 +2,85 @@
  * Created by He, Hao at 2019-3-11
  */
 
+#include <cerrno>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <string>
 
 #include <elfio/elfio.hpp>
 
+#include "BBVProfiler.h"
 #include "BranchPredictor.h"
 #include "Cache.h"
 #include "Debug.h"
 #include "MemoryManager.h"
+#include "PCProfiler.h"
+#include "PipeTracer.h"
 #include "Simulator.h"
 
+struct ElfSymbol {
+  std::string name;
+  uint32_t addr;
+  uint32_t size;
+  unsigned char type;
+  bool executable; // defined in a section holding instructions
+};
+
 bool parseParameters(int argc, char **argv);
+bool parseReplacement(char *spec);
+bool parsePrefetcher(char *spec);
+bool parseMSHRNum(char *spec);
+bool parseInstCount(const char *str, uint64_t max, uint64_t &count);
+bool parsePredictBypass(char *spec);
+bool parseInclusion(char *spec);
 void printUsage();
 void printElfInfo(ELFIO::elfio *reader);
 void loadElfToMemory(ELFIO::elfio *reader, MemoryManager *memory);
+std::vector<ElfSymbol> readSymbols(ELFIO::elfio *reader);
+bool findSymbol(ELFIO::elfio *reader, const std::string &name, uint32_t *addr);
+void loadFunctionSymbols(ELFIO::elfio *reader, PCProfiler *profiler);
 
 char *elfFile = nullptr;
 bool verbose = 0;
 bool isSingleStep = 0;
 bool dumpHistory = 0;
 bool dataforwarding = 1;
+bool unifiedL1 = 0;
+bool flatLatency = 0;
+bool functional = 0;
+uint64_t fastForwardInst = 0;
+char *fastForwardMarker = nullptr;
+uint32_t maxDetailedInst = 0;
+char *checkpointFile = nullptr;
+char *restoreFile = nullptr;
+char *bbvFile = nullptr;
+char *profileFile = nullptr;
+char *pipeTraceFile = nullptr;
+uint64_t bbvInterval = 100000000;
 uint32_t stackBaseAddr = 0x80000000;
 uint32_t stackSize = 0x400000;
 MemoryManager memory;
-Cache *l1Cache, *l2Cache, *l3Cache;
+Cache *l1Cache, *l1ICache, *l2Cache, *l3Cache;
+// Replacement policy of L1, L2 and L3
+ReplacementPolicy::Kind replacement[3] = {
+    ReplacementPolicy::LRU, ReplacementPolicy::LRU, ReplacementPolicy::LRU};
+// Prefetcher of L1, L2 and L3
+Prefetcher::Kind prefetcher[3] = {Prefetcher::NONE, Prefetcher::NONE,
+                                  Prefetcher::NONE};
+// MSHRs of L1, L2 and L3, 0 for a blocking cache
+uint32_t mshrNum[3] = {0, 0, 0};
+// Predicted bypassing in L1, L2 and L3
+bool predictBypass[3] = {false, false, false};
+// Inclusion of L2 and L3 towards the levels above them
+Cache::Inclusion inclusion[2] = {Cache::NINE, Cache::NINE};
 BranchPredictor::Strategy strategy = BranchPredictor::Strategy::NT;
 BranchPredictor branchPredictor;
+BBVProfiler bbvProfiler;
+PCProfiler pcProfiler;
+PipeTracer pipeTracer;
 Simulator simulator(&memory, &branchPredictor);
 
 int main(int argc, char **argv) {
@@ -49,6 +98,13 @@ int main(int argc, char **argv) {
   l1Policy.associativity = 8;
   l1Policy.hitLatency = 0;
   l1Policy.missLatency = 8;
+  l1Policy.flatLatency = flatLatency;
+  l1Policy.replacement = replacement[0];
+  l1Policy.prefetcher = prefetcher[0];
+  l1Policy.mshrNum = mshrNum[0];
+  l1Policy.writeBufferSize = 0; // write back, stores stay in the cache
+  l1Policy.predictBypass = predictBypass[0];
+  l1Policy.inclusion = Cache::NINE;
 
   l2Policy.cacheSize = 256 * 1024;
   l2Policy.blockSize = 64;
@@ -56,6 +112,13 @@ int main(int argc, char **argv) {
   l2Policy.associativity = 8;
   l2Policy.hitLatency = 8;
   l2Policy.missLatency = 20;
+  l2Policy.flatLatency = flatLatency;
+  l2Policy.replacement = replacement[1];
+  l2Policy.prefetcher = prefetcher[1];
+  l2Policy.mshrNum = mshrNum[1];
+  l2Policy.writeBufferSize = 0;
+  l2Policy.predictBypass = predictBypass[1];
+  l2Policy.inclusion = inclusion[0];
 
   l3Policy.cacheSize = 8 * 1024 * 1024;
   l3Policy.blockSize = 64;
@@ -63,12 +126,30 @@ int main(int argc, char **argv) {
   l3Policy.associativity = 8;
   l3Policy.hitLatency = 20;
   l3Policy.missLatency = 100;
+  l3Policy.flatLatency = flatLatency;
+  l3Policy.replacement = replacement[2];
+  l3Policy.prefetcher = prefetcher[2];
+  l3Policy.mshrNum = mshrNum[2];
+  l3Policy.writeBufferSize = 0;
+  l3Policy.predictBypass = predictBypass[2];
+  l3Policy.inclusion = inclusion[1];
 
   l3Cache = new Cache(&memory, l3Policy);
   l2Cache = new Cache(&memory, l2Policy, l3Cache);
   l1Cache = new Cache(&memory, l1Policy, l2Cache);
-
-  memory.setCache(l1Cache);
+  // Split L1, both halves in front of the shared L2. Instruction fetches
+  // are never bypassed. A unified L1 leaves the data cache alone above L2.
+  Cache::Policy l1IPolicy = l1Policy;
+  l1IPolicy.predictBypass = false;
+  l1ICache = unifiedL1 ? nullptr : new Cache(&memory, l1IPolicy, l2Cache);
+
+  // The functional model accesses memory directly
+  if (!functional) {
+    memory.setCache(l1Cache);
+    if (!unifiedL1) {
+      memory.setInstCache(l1ICache);
+    }
+  }
 
   // Read ELF file
   ELFIO::elfio reader;
@@ -81,10 +162,9 @@ int main(int argc, char **argv) {
     printElfInfo(&reader);
   }
 
-  loadElfToMemory(&reader, &memory);
-
-  if (verbose) {
-    memory.printInfo();
+  // A checkpoint carries its own memory image
+  if (restoreFile == nullptr) {
+    loadElfToMemory(&reader, &memory);
   }
 
   simulator.isSingleStep = isSingleStep;
@@ -92,16 +172,81 @@ int main(int argc, char **argv) {
   simulator.shouldDumpHistory = dumpHistory;
   simulator.dataforwarding = dataforwarding;
   simulator.branchPredictor->strategy = strategy;
-  simulator.pc = reader.get_entry();
-  simulator.initStack(stackBaseAddr, stackSize);
-  simulator.simulate();
+  simulator.fastForwardInst = fastForwardInst;
+  if (fastForwardMarker != nullptr) {
+    // The name of a symbol or else a hexadecimal address, so symbols such
+    // as add or beef are not taken for addresses
+    uint32_t addr;
+    if (!findSymbol(&reader, fastForwardMarker, &addr)) {
+      char *end;
+      addr = strtoul(fastForwardMarker, &end, 16);
+      if (end == fastForwardMarker || *end != '\0') {
+        fprintf(stderr, "Unknown marker %s!\n", fastForwardMarker);
+        return -1;
+      }
+    }
+    simulator.hasFastForwardMarker = true;
+    simulator.fastForwardMarker = addr;
+  }
+  simulator.maxDetailedInst = maxDetailedInst;
+  if (bbvFile != nullptr) {
+    if (!bbvProfiler.open(bbvFile, bbvInterval)) {
+      fprintf(stderr, "Fail to open %s!\n", bbvFile);
+      return -1;
+    }
+    simulator.bbvProfiler = &bbvProfiler;
+  }
+  if (profileFile != nullptr) {
+    if (!pcProfiler.open(profileFile)) {
+      fprintf(stderr, "Fail to open %s!\n", profileFile);
+      return -1;
+    }
+    loadFunctionSymbols(&reader, &pcProfiler);
+    simulator.pcProfiler = &pcProfiler;
+  }
+  if (pipeTraceFile != nullptr) {
+    if (!pipeTracer.open(pipeTraceFile)) {
+      fprintf(stderr, "Fail to open %s!\n", pipeTraceFile);
+      return -1;
+    }
+    simulator.pipeTracer = &pipeTracer;
+  }
+  if (restoreFile != nullptr) {
+    if (!simulator.loadCheckpoint(restoreFile)) {
+      fprintf(stderr, "Fail to restore checkpoint %s!\n", restoreFile);
+      return -1;
+    }
+  } else {
+    simulator.pc = reader.get_entry();
+    simulator.initStack(stackBaseAddr, stackSize);
+  }
+
+  if (verbose) {
+    memory.printInfo();
+  }
+
+  if (checkpointFile != nullptr) {
+    // The caches and the predictor are only warmed in detailed mode
+    simulator.fastForward(!functional);
+    if (!simulator.saveCheckpoint(checkpointFile)) {
+      fprintf(stderr, "Fail to write checkpoint %s!\n", checkpointFile);
+      return -1;
+    }
+    printf("Checkpoint written to %s\n", checkpointFile);
+  } else if (functional) {
+    simulator.simulateFunctional();
+  } else {
+    simulator.simulate();
+  }
 
   if (dumpHistory) {
     printf("Dumping history to dump.txt...\n");
     simulator.dumpHistory();
   }
+  bbvProfiler.close();
 
   delete l1Cache;
+  delete l1ICache;
   delete l2Cache;
   delete l3Cache;
   return 0;
@@ -143,6 +288,133 @@ bool parseParameters(int argc, char **argv) {
       case 'x':
         dataforwarding = 0;
         break;
+      case 'u':
+        unifiedL1 = 1;
+        break;
+      case 'L':
+        flatLatency = 1;
+        break;
+      case 'r':
+        if (i + 1 < argc) {
+          if (!parseReplacement(argv[++i])) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+        break;
+      case 'a':
+        if (i + 1 < argc) {
+          if (!parsePrefetcher(argv[++i])) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+        break;
+      case 'm':
+        if (i + 1 < argc) {
+          if (!parseMSHRNum(argv[++i])) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+        break;
+      case 'n':
+        if (i + 1 < argc) {
+          if (!parsePredictBypass(argv[++i])) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+        break;
+      case 'H':
+        if (i + 1 < argc) {
+          if (!parseInclusion(argv[++i])) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+        break;
+      case 'f':
+        functional = 1;
+        break;
+      case 'F':
+        if (i + 1 < argc) {
+          if (!parseInstCount(argv[++i], UINT64_MAX, fastForwardInst)) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+        break;
+      case 'M':
+        if (i + 1 < argc) {
+          fastForwardMarker = argv[++i];
+        } else {
+          return false;
+        }
+        break;
+      case 'R':
+        if (i + 1 < argc) {
+          uint64_t num;
+          // The detailed region counts instructions in 32 bits
+          if (!parseInstCount(argv[++i], UINT32_MAX, num)) {
+            return false;
+          }
+          maxDetailedInst = num;
+        } else {
+          return false;
+        }
+        break;
+      case 'c':
+        if (i + 1 < argc) {
+          checkpointFile = argv[++i];
+        } else {
+          return false;
+        }
+        break;
+      case 'l':
+        if (i + 1 < argc) {
+          restoreFile = argv[++i];
+        } else {
+          return false;
+        }
+        break;
+      case 'p':
+        if (i + 1 < argc) {
+          bbvFile = argv[++i];
+        } else {
+          return false;
+        }
+        break;
+      case 'P':
+        if (i + 1 < argc) {
+          profileFile = argv[++i];
+        } else {
+          return false;
+        }
+        break;
+      case 't':
+        if (i + 1 < argc) {
+          pipeTraceFile = argv[++i];
+        } else {
+          return false;
+        }
+        break;
+      case 'i':
+        if (i + 1 < argc) {
+          bbvInterval = strtoull(argv[++i], nullptr, 10);
+          if (bbvInterval == 0) {
+            return false;
+          }
+        } else {
+          return false;
+        }
+        break;
       default:
         return false;
       }
@@ -157,13 +429,164 @@ bool parseParameters(int argc, char **argv) {
   if (elfFile == nullptr) {
     return false;
   }
+  // Without a stop point the program runs to its exit and the checkpoint
+  // is never written
+  if (checkpointFile != nullptr && fastForwardInst == 0 &&
+      fastForwardMarker == nullptr) {
+    fprintf(stderr, "-c needs -F or -M\n");
+    return false;
+  }
+  return true;
+}
+
+// A comma separated list of policies for L1, L2 and L3, levels left out
+// use the last policy given
+bool parseReplacement(char *spec) {
+  int level = 0;
+  for (char *name = strtok(spec, ","); name != nullptr;
+       name = strtok(nullptr, ",")) {
+    if (level == 3 || !ReplacementPolicy::parseKind(name, &replacement[level])) {
+      return false;
+    }
+    if (replacement[level] == ReplacementPolicy::OPT) {
+      fprintf(stderr, "OPT replacement needs a memory trace, use CacheSim\n");
+      return false;
+    }
+    level++;
+  }
+  if (level == 0) {
+    return false;
+  }
+  for (; level < 3; ++level) {
+    replacement[level] = replacement[level - 1];
+  }
+  return true;
+}
+
+// A comma separated list of prefetchers for L1, L2 and L3, levels left out
+// have none
+bool parsePrefetcher(char *spec) {
+  int level = 0;
+  for (char *name = strtok(spec, ","); name != nullptr;
+       name = strtok(nullptr, ",")) {
+    if (level == 3 || !Prefetcher::parseKind(name, &prefetcher[level])) {
+      return false;
+    }
+    level++;
+  }
+  return level > 0;
+}
+
+// A decimal instruction count no larger than max, strtoull alone would
+// accept trailing garbage and wrap negative numbers around
+bool parseInstCount(const char *str, uint64_t max, uint64_t &count) {
+  char *end;
+  if (str[0] < '0' || str[0] > '9') {
+    return false;
+  }
+  errno = 0;
+  unsigned long long num = strtoull(str, &end, 10);
+  if (*end != '\0' || errno == ERANGE || num > max) {
+    return false;
+  }
+  count = num;
+  return true;
+}
+
+// A comma separated list of MSHR counts for L1, L2 and L3, levels left out
+// are blocking
+bool parseMSHRNum(char *spec) {
+  int level = 0;
+  for (char *num = strtok(spec, ","); num != nullptr;
+       num = strtok(nullptr, ",")) {
+    char *end;
+    if (level == 3) {
+      return false;
+    }
+    mshrNum[level] = strtoul(num, &end, 10);
+    if (*end != '\0') {
+      return false;
+    }
+    level++;
+  }
+  return level > 0;
+}
+
+// A comma separated list of 0 or 1 for L1, L2 and L3, levels left out do
+// not predict bypassing
+bool parsePredictBypass(char *spec) {
+  int level = 0;
+  for (char *flag = strtok(spec, ","); flag != nullptr;
+       flag = strtok(nullptr, ",")) {
+    if (level == 3 || (strcmp(flag, "0") != 0 && strcmp(flag, "1") != 0)) {
+      return false;
+    }
+    predictBypass[level] = flag[0] == '1';
+    level++;
+  }
+  return level > 0;
+}
+
+// A comma separated list of inclusion policies for L2 and L3, levels left
+// out use the last one given
+bool parseInclusion(char *spec) {
+  int level = 0;
+  for (char *name = strtok(spec, ","); name != nullptr;
+       name = strtok(nullptr, ",")) {
+    if (level == 2 || !Cache::parseInclusion(name, &inclusion[level])) {
+      return false;
+    }
+    level++;
+  }
+  if (level == 0) {
+    return false;
+  }
+  for (; level < 2; ++level) {
+    inclusion[level] = inclusion[level - 1];
+  }
   return true;
 }
 
 void printUsage() {
-  printf("Usage: Simulator riscv-elf-file [-v] [-s] [-d] [-b param]\n");
+  printf("Usage: Simulator riscv-elf-file [-v] [-s] [-d] [-f] [-F num] "
+         "[-M marker] [-R num] [-c file] [-l file] [-p file] [-i num] "
+         "[-P file] [-t file] [-u] [-L] [-r policies] [-a prefetchers] "
+         "[-m mshrs] [-n flags] [-H policies] [-b param]\n");
   printf("Parameters: \n\t[-v] verbose output \n\t[-s] single step\n");
   printf("\t[-d] dump memory and register trace to dump.txt\n");
+  printf("\t[-f] functional simulation without pipeline and cache timing\n");
+  printf("\t[-F num] fast-forward num instructions before detailed "
+         "simulation\n");
+  printf("\t[-M marker] fast-forward until the PC reaches marker, a symbol "
+         "or else a hex address\n");
+  printf("\t[-R num] stop detailed simulation after num instructions, at "
+         "most 4294967295\n");
+  printf("\t[-c file] write a checkpoint where fast-forwarding stops, needs "
+         "-F or -M\n");
+  printf("\t[-l file] start from a checkpoint instead of the ELF entry\n");
+  printf("\t[-p file] write SimPoint basic block vectors to file\n");
+  printf("\t[-i num] basic block vector interval in instructions, default "
+         "100000000\n");
+  printf("\t[-P file] attribute cycles to PCs and functions, writing a CSV "
+         "to file\n");
+  printf("\t[-t file] write a pipeline timeline for the Konata viewer to "
+         "file\n");
+  printf("\t[-u] unified L1, fetches share the data cache and their latency "
+         "is not modelled\n");
+  printf("\t[-L] flat cache latency of the original simulator, a miss costs "
+         "the hit latency of the level below\n");
+  printf("\t[-r policies] replacement policy of L1, L2 and L3, comma "
+         "separated, default LRU, accepted LRU, TreePLRU, BitPLRU, FIFO, "
+         "Random, SRRIP, BRRIP, DRRIP, DIP\n");
+  printf("\t[-a prefetchers] prefetcher of L1, L2 and L3, comma separated, "
+         "default None, accepted None, NextLine, Stride, Stream\n");
+  printf("\t[-m mshrs] MSHRs of L1, L2 and L3, comma separated, default 0 "
+         "for blocking caches\n");
+  printf("\t[-n flags] predicted bypassing in L1, L2 and L3, comma "
+         "separated 0 or 1, default 0\n");
+  printf("\t[-H policies] inclusion of L2 and L3 towards the levels above, "
+         "comma separated, default NINE, accepted NINE, Inclusive, "
+         "Exclusive\n");
   printf("\t[-b param] branch perdiction strategy, accepted param AT, NT, "
          "BTFNT, BPB\n");
 }
@@ -243,4 +666,57 @@ void loadElfToMemory(ELFIO::elfio *reader, MemoryManager *memory) {
       }
     }
   }
-}
\ No newline at end of file
+}
+
+std::vector<ElfSymbol> readSymbols(ELFIO::elfio *reader) {
+  std::vector<ElfSymbol> result;
+  ELFIO::Elf_Half sec_num = reader->sections.size();
+  for (int i = 0; i < sec_num; ++i) {
+    ELFIO::section *psec = reader->sections[i];
+    if (psec->get_type() != SHT_SYMTAB) {
+      continue;
+    }
+    ELFIO::symbol_section_accessor symbols(*reader, psec);
+    for (ELFIO::Elf_Xword j = 0; j < symbols.get_symbols_num(); ++j) {
+      ElfSymbol symbol;
+      ELFIO::Elf64_Addr value = 0;
+      ELFIO::Elf_Xword size = 0;
+      unsigned char bind = 0, other = 0;
+      ELFIO::Elf_Half sectionIndex = SHN_UNDEF;
+      if (!symbols.get_symbol(j, symbol.name, value, size, bind, symbol.type,
+                              sectionIndex, other)) {
+        continue;
+      }
+      symbol.addr = (uint32_t)value;
+      symbol.size = (uint32_t)size;
+      symbol.executable =
+          sectionIndex != SHN_UNDEF && sectionIndex < sec_num &&
+          (reader->sections[sectionIndex]->get_flags() & SHF_EXECINSTR);
+      result.push_back(symbol);
+    }
+  }
+  return result;
+}
+
+bool findSymbol(ELFIO::elfio *reader, const std::string &name,
+                uint32_t *addr) {
+  for (const ElfSymbol &symbol : readSymbols(reader)) {
+    if (symbol.name == name) {
+      *addr = symbol.addr;
+      return true;
+    }
+  }
+  return false;
+}
+
+void loadFunctionSymbols(ELFIO::elfio *reader, PCProfiler *profiler) {
+  // Hand-written assembly labels its functions with untyped symbols,
+  // assembler-local labels and mapping symbols are skipped
+  for (const ElfSymbol &symbol : readSymbols(reader)) {
+    if (symbol.executable && !symbol.name.empty() && symbol.name[0] != '$' &&
+        symbol.name.compare(0, 2, ".L") != 0 &&
+        (symbol.type == STT_FUNC || symbol.type == STT_NOTYPE)) {
+      profiler->addSymbol(symbol.addr, symbol.size, symbol.name);
+    }
+  }
+}
@@ -8,54 +8,202 @@
 
  #include <cstdint>
  #include <cstdlib>
+ #include <cstring>
+ #include <strings.h>
  #include <fstream>
  #include <iostream>
+ #include <map>
+ #include <mutex>
+ #include <sstream>
  #include <string>
  #include <vector>
  
  #include "Cache.h"
  #include "Debug.h"
  #include "MemoryManager.h"
+ #include "StackDistance.h"
+ #include "ThreadPool.h"
+ #include "Trace.h"
+ 
+ // The whole trace, parsed once and shared read-only by every configuration
+ struct Trace {
+   std::vector<uint32_t> addr;
+   std::vector<uint8_t> size;
+   std::vector<bool> isWrite;
+   std::vector<uint32_t> pc; // empty if the trace has no PCs
+ };
+ 
+ // Key of a swept configuration: cacheSize, blockSize, associativity
+ typedef std::pair<std::pair<uint32_t, uint32_t>, uint32_t> ConfigKey;
  
  bool parseParameters(int argc, char **argv);
+ bool parseReplacements(char *list);
  void printUsage();
- void simulateCache(std::ofstream &csvFile, uint32_t cacheSize,
-                    uint32_t blockSize, uint32_t associativity, bool writeBack,
-                    bool writeAllocate);
+ std::string simulateCache(const Trace &trace, uint32_t cacheSize,
+                           uint32_t blockSize, uint32_t associativity,
+                           bool writeBack, bool writeAllocate,
+                           ReplacementPolicy::Kind replacement,
+                           const std::vector<uint32_t> *nextUse);
+ void loadTrace(Trace &trace);
+ void computeNextUse(const Trace &trace, uint32_t blockSize,
+                     std::vector<uint32_t> &nextUse);
+ void computeStackDistances(const Trace &trace, uint32_t blockSize,
+                            std::map<ConfigKey, StackDistance::Result> &results);
+ std::string formatStackDistanceResult(uint32_t cacheSize, uint32_t blockSize,
+                                       uint32_t associativity, bool writeBack,
+                                       const StackDistance::Result &result);
+ std::string formatRow(uint32_t cacheSize, uint32_t blockSize,
+                       uint32_t associativity, bool writeBack,
+                       bool writeAllocate, float missRate,
+                       uint64_t totalCycles,
+                       ReplacementPolicy::Kind replacement);
  
  bool verbose = false;
  bool isSingleStep = false;
+ bool stackDistanceMode = false;
+ uint32_t threadNum = 1;
+ // Replacement policies to sweep, LRU only by default
+ std::vector<ReplacementPolicy::Kind> replacements = {ReplacementPolicy::LRU};
+ Prefetcher::Kind prefetcher = Prefetcher::NONE;
+ // Entries of the write buffer in front of memory, used by the stores that
+ // bypass or write through the cache
+ uint32_t writeBufferSize = 8;
+ bool predictBypass = false;
  const char *traceFilePath;
+ std::mutex outputLock;
+ 
+ const uint32_t MIN_CACHE_SIZE = 32 * 1024;
+ const uint32_t MAX_CACHE_SIZE = 32 * 1024 * 1024;
+ const uint32_t MAX_BLOCK_SIZE = 4096;
+ const uint32_t MAX_ASSOCIATIVITY = 32;
+ const uint32_t HIT_LATENCY = 1;
+ const uint32_t MISS_LATENCY = 8;
  
  int main(int argc, char **argv) {
    if (!parseParameters(argc, argv)) {
+     printUsage();
      return -1;
    }
+   if (verbose || isSingleStep) {
+     threadNum = 1;
+   }
  
-   // Open CSV file and write header
-   std::ofstream csvFile(std::string(traceFilePath) + ".csv");
-   csvFile << "cacheSize,blockSize,associativity,writeBack,writeAllocate,"
-              "missRate,totalCycles\n";
+   Trace trace;
+   loadTrace(trace);
+   if (predictBypass && trace.pc.empty()) {
+     printf("Predicted bypassing needs a trace with PCs\n");
+     return -1;
+   }
+   if (prefetcher == Prefetcher::STRIDE && trace.pc.empty()) {
+     printf("The stride prefetcher needs a trace with PCs\n");
+     return -1;
+   }
+   ThreadPool pool(threadNum);
+ 
+   // In stack distance mode every write-allocate configuration is derived
+   // from one pass over the trace per block size
+   std::map<ConfigKey, StackDistance::Result> stackResults;
+   if (stackDistanceMode) {
+     std::vector<std::map<ConfigKey, StackDistance::Result>> partialResults;
+     std::vector<std::function<void()>> tasks;
+     for (uint32_t blockSize = 1; blockSize <= MAX_BLOCK_SIZE; blockSize *= 2) {
+       partialResults.push_back(std::map<ConfigKey, StackDistance::Result>());
+     }
+     for (uint32_t i = 0, blockSize = 1; blockSize <= MAX_BLOCK_SIZE;
+          ++i, blockSize *= 2) {
+       std::map<ConfigKey, StackDistance::Result> *results =
+           &partialResults[i];
+       tasks.push_back([&trace, blockSize, results]() {
+         computeStackDistances(trace, blockSize, *results);
+       });
+     }
+     pool.run(tasks);
+     for (auto &results : partialResults) {
+       stackResults.insert(results.begin(), results.end());
+     }
+   }
+ 
+   // OPT looks up the next use of every line access, one sequence per block
+   // size shared by all the caches with that block size
+   std::map<uint32_t, std::vector<uint32_t>> nextUses;
+   for (ReplacementPolicy::Kind replacement : replacements) {
+     if (replacement != ReplacementPolicy::OPT) {
+       continue;
+     }
+     std::vector<std::function<void()>> tasks;
+     for (uint32_t blockSize = 1; blockSize <= MAX_BLOCK_SIZE; blockSize *= 2) {
+       std::vector<uint32_t> *nextUse = &nextUses[blockSize];
+       tasks.push_back([&trace, blockSize, nextUse]() {
+         computeNextUse(trace, blockSize, *nextUse);
+       });
+     }
+     pool.run(tasks);
+     break;
+   }
+ 
+   // Every CSV row is produced by its own task and written out in sweep
+   // order once all of them have finished
+   std::vector<std::string> rows;
+   std::vector<std::function<void()>> tasks;
  
    // Cache Size: 32 Kb to 32 Mb
-   for (uint32_t cacheSize = 32 * 1024; cacheSize <= 32 * 1024 * 1024;
+   for (uint32_t cacheSize = MIN_CACHE_SIZE; cacheSize <= MAX_CACHE_SIZE;
         cacheSize *= 2) {
      // Block Size: 1 byte to 4096 byte
      // The maximum block size is imposed by VM page size
-     for (uint32_t blockSize = 1; blockSize <= 4096; blockSize *= 2) {
-       for (uint32_t associativity = 1; associativity <= 32;
+     for (uint32_t blockSize = 1; blockSize <= MAX_BLOCK_SIZE; blockSize *= 2) {
+       for (uint32_t associativity = 1; associativity <= MAX_ASSOCIATIVITY;
             associativity *= 2) {
          uint32_t blockNum = cacheSize / blockSize;
          if (blockNum % associativity != 0)
            continue;
  
-         simulateCache(csvFile, cacheSize, blockSize, associativity, true, true);
-         simulateCache(csvFile, cacheSize, blockSize, associativity, true, false);
-         simulateCache(csvFile, cacheSize, blockSize, associativity, false, true);
-         simulateCache(csvFile, cacheSize, blockSize, associativity, false, false);
+         const bool writeBacks[] = {true, true, false, false};
+         const bool writeAllocates[] = {true, false, true, false};
+         for (int i = 0; i < 4; ++i) {
+           bool writeBack = writeBacks[i];
+           bool writeAllocate = writeAllocates[i];
+           for (ReplacementPolicy::Kind replacement : replacements) {
+             size_t row = rows.size();
+             rows.push_back("");
+             // No-write-allocate caches do not obey the LRU inclusion
+             // property and the other policies, prefetching, bypassing and
+             // the timing of a write buffer have no stack distance model,
+             // so those points are still simulated directly
+             if (stackDistanceMode && writeAllocate &&
+                 (writeBack || writeBufferSize == 0) &&
+                 replacement == ReplacementPolicy::LRU &&
+                 prefetcher == Prefetcher::NONE && !predictBypass) {
+               rows[row] = formatStackDistanceResult(
+                   cacheSize, blockSize, associativity, writeBack,
+                   stackResults[ConfigKey(
+                       std::make_pair(cacheSize, blockSize), associativity)]);
+               continue;
+             }
+             const std::vector<uint32_t> *nextUse =
+                 replacement == ReplacementPolicy::OPT ? &nextUses[blockSize]
+                                                       : nullptr;
+             tasks.push_back([&trace, &rows, row, cacheSize, blockSize,
+                              associativity, writeBack, writeAllocate,
+                              replacement, nextUse]() {
+               rows[row] = simulateCache(trace, cacheSize, blockSize,
+                                         associativity, writeBack,
+                                         writeAllocate, replacement, nextUse);
+             });
+           }
+         }
        }
      }
    }
+   pool.run(tasks);
+ 
+   // Open CSV file and write header
+   std::ofstream csvFile(std::string(traceFilePath) + ".csv");
+   csvFile << "cacheSize,blockSize,associativity,writeBack,writeAllocate,"
+              "missRate,totalCycles,replacement\n";
+   for (const std::string &row : rows) {
+     csvFile << row;
+   }
  
    printf("Result has been written to %s\n",
           (std::string(traceFilePath) + ".csv").c_str());
@@ -74,6 +222,54 @@
        case 's':
          isSingleStep = 1;
          break;
+       case 'm':
+         stackDistanceMode = 1;
+         break;
+       case 'n':
+         predictBypass = 1;
+         break;
+       case 'r':
+         if (i + 1 < argc) {
+           if (!parseReplacements(argv[++i])) {
+             return false;
+           }
+         } else {
+           return false;
+         }
+         break;
+       case 'a':
+         if (i + 1 < argc) {
+           if (!Prefetcher::parseKind(argv[++i], &prefetcher)) {
+             return false;
+           }
+         } else {
+           return false;
+         }
+         break;
+       case 'w':
+         if (i + 1 < argc) {
+           char *end;
+           long num = strtol(argv[++i], &end, 10);
+           if (*end != '\0' || num < 0 || num > 1024) {
+             return false;
+           }
+           writeBufferSize = num;
+         } else {
+           return false;
+         }
+         break;
+       case 'j':
+         if (i + 1 < argc) {
+           char *end;
+           long num = strtol(argv[++i], &end, 10);
+           if (*end != '\0' || num <= 0 || num > 1024) {
+             return false;
+           }
+           threadNum = num;
+         } else {
+           return false;
+         }
+         break;
        default:
          return false;
        }
@@ -91,54 +287,85 @@
    return true;
  }
  
+ // A comma separated list of policy names, or all
+ bool parseReplacements(char *list) {
+   replacements.clear();
+   if (strcasecmp(list, "all") == 0) {
+     for (int i = 0; i < ReplacementPolicy::KIND_NUM; ++i) {
+       replacements.push_back(ReplacementPolicy::Kind(i));
+     }
+     return true;
+   }
+   for (char *name = strtok(list, ","); name != nullptr;
+        name = strtok(nullptr, ",")) {
+     ReplacementPolicy::Kind kind;
+     if (!ReplacementPolicy::parseKind(name, &kind)) {
+       return false;
+     }
+     replacements.push_back(kind);
+   }
+   return !replacements.empty();
+ }
+ 
  void printUsage() {
-   printf("Usage: CacheSim trace-file [-s] [-v]\n");
-   printf("Parameters: -s single step, -v verbose output\n");
+   printf("Usage: CacheSim trace-file [-s] [-v] [-m] [-n] [-j threads] "
+          "[-r policies] [-a prefetcher] [-w entries]\n");
+   printf("Parameters: -s single step, -v verbose output, -m single-pass LRU "
+          "stack distance sweep, -n predicted bypassing in every "
+          "configuration, -j number of worker threads, 1 to 1024, -r "
+          "replacement policies to sweep, comma separated or all, default "
+          "LRU, -a prefetcher of every configuration, default None, -w write "
+          "buffer entries, 0 to 1024, 0 to write through synchronously, "
+          "default 8\n");
  }
  
- void simulateCache(std::ofstream &csvFile, uint32_t cacheSize,
-                    uint32_t blockSize, uint32_t associativity, bool writeBack,
-                    bool writeAllocate) {
+ std::string simulateCache(const Trace &trace, uint32_t cacheSize,
+                           uint32_t blockSize, uint32_t associativity,
+                           bool writeBack, bool writeAllocate,
+                           ReplacementPolicy::Kind replacement,
+                           const std::vector<uint32_t> *nextUse) {
    Cache::Policy policy;
    policy.cacheSize = cacheSize;
    policy.blockSize = blockSize;
    policy.blockNum = cacheSize / blockSize;
    policy.associativity = associativity;
-   policy.hitLatency = 1;
-   policy.missLatency = 8;
+   policy.hitLatency = HIT_LATENCY;
+   policy.missLatency = MISS_LATENCY;
+   policy.flatLatency = false;
+   policy.replacement = replacement;
+   policy.prefetcher = replacement == ReplacementPolicy::OPT ? Prefetcher::NONE
+                                                             : prefetcher;
+   // Trace records carry no timing, the cache blocks on every miss
+   policy.mshrNum = 0;
+   policy.writeBufferSize = writeBufferSize;
+   policy.predictBypass =
+       replacement == ReplacementPolicy::OPT ? false : predictBypass;
+   policy.inclusion = Cache::NINE; // a single level
  
    // Initialize memory and cache
    MemoryManager *memory = nullptr;
    Cache *cache = nullptr;
    memory = new MemoryManager();
    cache = new Cache(memory, policy, nullptr, writeBack, writeAllocate);
+   cache->setNextUse(nextUse);
    memory->setCache(cache);
  
-   cache->printInfo(false);
- 
-   // Read and execute trace in cache-trace/ folder
-   std::ifstream trace(traceFilePath);
-   if (!trace.is_open()) {
-     printf("Unable to open file %s\n", traceFilePath);
-     exit(-1);
-   }
- 
-   char type; //'r' for read, 'w' for write
-   uint32_t addr;
-   while (trace >> type >> std::hex >> addr) {
+   // Execute the trace loaded from cache-trace/ folder
+   uint8_t data[8] = {0};
+   uint64_t cycle = 0;
+   for (size_t i = 0; i < trace.addr.size(); ++i) {
+     uint32_t addr = trace.addr[i];
+     // Each trace record issues once the previous one has completed, so
+     // buffered stores drain while the following accesses go on
+     cache->setAccessInfo(trace.pc.empty() ? 0 : trace.pc[i], cycle);
      if (verbose)
-       printf("%c %x\n", type, addr);
-     switch (type) {
-     case 'r':
-       cache->getByte(addr);
-       break;
-     case 'w':
-       cache->setByte(addr, 0);
-       break;
-     default:
-       dbgprintf("Illegal type %c\n", type);
-       exit(-1);
+       printf("%c %x\n", trace.isWrite[i] ? 'w' : 'r', addr);
+     if (trace.isWrite[i]) {
+       cache->writeBlock(addr, trace.size[i], data);
+     } else {
+       cache->readBlock(addr, trace.size[i], data);
      }
+     cycle = cache->getLastTiming().ready;
  
      if (verbose)
        cache->printInfo(true);
@@ -150,13 +377,146 @@
    }
  
    // Output Simulation Results
-   cache->printStatistics();
+   {
+     std::lock_guard<std::mutex> guard(outputLock);
+     cache->printInfo(false);
+     cache->printStatistics();
+   }
    float missRate = (float)cache->statistics.numMiss /
                     (cache->statistics.numHit + cache->statistics.numMiss);
-   csvFile << cacheSize << "," << blockSize << "," << associativity << ","
-           << writeBack << "," << writeAllocate << "," << missRate << ","
-           << cache->statistics.totalCycles << std::endl;
+   uint64_t totalCycles = cache->statistics.totalCycles;
  
    delete cache;
    delete memory;
- }
\ No newline at end of file
+   return formatRow(cacheSize, blockSize, associativity, writeBack,
+                    writeAllocate, missRate, totalCycles, replacement);
+ }
+ 
+ void loadTrace(Trace &trace) {
+   TraceReader reader;
+   if (!reader.open(traceFilePath)) {
+     printf("Unable to open file %s\n", traceFilePath);
+     exit(-1);
+   }
+ 
+   trace.addr.reserve(reader.recordNum());
+   trace.size.reserve(reader.recordNum());
+   trace.isWrite.reserve(reader.recordNum());
+   TraceRecord record;
+   while (reader.next(record)) {
+     trace.addr.push_back(record.addr);
+     trace.size.push_back(record.size);
+     trace.isWrite.push_back(record.isWrite);
+     if (reader.hasPC()) {
+       trace.pc.push_back(record.pc);
+     }
+   }
+ }
+ 
+ // Like Cache, an access straddling lines is one access per line
+ void computeNextUse(const Trace &trace, uint32_t blockSize,
+                     std::vector<uint32_t> &nextUse) {
+   std::vector<uint32_t> lines;
+   lines.reserve(trace.addr.size());
+   for (size_t i = 0; i < trace.addr.size(); ++i) {
+     uint32_t first = trace.addr[i] & ~(blockSize - 1);
+     uint32_t last = (trace.addr[i] + trace.size[i] - 1) & ~(blockSize - 1);
+     for (uint32_t line = first;; line += blockSize) {
+       lines.push_back(line);
+       if (line == last)
+         break;
+     }
+   }
+   nextUse = OPTPolicy::computeNextUse(lines);
+ }
+ 
+ void computeStackDistances(const Trace &trace, uint32_t blockSize,
+                            std::map<ConfigKey, StackDistance::Result> &results) {
+   // One engine per set count, deep enough for the largest associativity
+   // swept with that set count
+   std::map<uint32_t, uint32_t> maxWays;
+   for (uint32_t cacheSize = MIN_CACHE_SIZE; cacheSize <= MAX_CACHE_SIZE;
+        cacheSize *= 2) {
+     for (uint32_t associativity = 1; associativity <= MAX_ASSOCIATIVITY;
+          associativity *= 2) {
+       uint32_t blockNum = cacheSize / blockSize;
+       if (blockNum % associativity != 0)
+         continue;
+       uint32_t &ways = maxWays[blockNum / associativity];
+       if (associativity > ways)
+         ways = associativity;
+     }
+   }
+ 
+   std::map<uint32_t, StackDistance *> engines;
+   for (auto &it : maxWays) {
+     engines[it.first] = new StackDistance(blockSize, it.first, it.second);
+   }
+ 
+   {
+     std::lock_guard<std::mutex> guard(outputLock);
+     printf("Computing stack distances for block size %u (%zu set counts)\n",
+            blockSize, engines.size());
+   }
+   for (size_t i = 0; i < trace.addr.size(); ++i) {
+     // Like Cache, an access straddling lines counts once per line
+     uint32_t first = trace.addr[i] & ~(blockSize - 1);
+     uint32_t last = (trace.addr[i] + trace.size[i] - 1) & ~(blockSize - 1);
+     for (uint32_t line = first;; line += blockSize) {
+       for (auto &it : engines) {
+         it.second->access(line, trace.isWrite[i]);
+       }
+       if (line == last)
+         break;
+     }
+   }
+ 
+   for (uint32_t cacheSize = MIN_CACHE_SIZE; cacheSize <= MAX_CACHE_SIZE;
+        cacheSize *= 2) {
+     for (uint32_t associativity = 1; associativity <= MAX_ASSOCIATIVITY;
+          associativity *= 2) {
+       uint32_t blockNum = cacheSize / blockSize;
+       if (blockNum % associativity != 0)
+         continue;
+       StackDistance *engine = engines[blockNum / associativity];
+       results[ConfigKey(std::make_pair(cacheSize, blockSize),
+                         associativity)] = engine->getResult(associativity);
+     }
+   }
+ 
+   for (auto &it : engines) {
+     delete it.second;
+   }
+ }
+ 
+ std::string formatStackDistanceResult(uint32_t cacheSize, uint32_t blockSize,
+                                       uint32_t associativity, bool writeBack,
+                                       const StackDistance::Result &result) {
+   // Same cost model as Cache: every access looks up the tags and a miss
+   // goes to memory, write-through sends every write on to memory and
+   // write-back every dirty eviction
+   uint64_t totalCycles = (result.numHit + result.numMiss) * HIT_LATENCY +
+                          result.numMiss * MISS_LATENCY;
+   if (writeBack) {
+     totalCycles += result.numDirtyEviction * MISS_LATENCY;
+   } else {
+     totalCycles += result.numWrite * MISS_LATENCY;
+   }
+   float missRate = (float)(uint32_t)result.numMiss /
+                    (uint32_t)(result.numHit + result.numMiss);
+   return formatRow(cacheSize, blockSize, associativity, writeBack, true,
+                    missRate, totalCycles, ReplacementPolicy::LRU);
+ }
+ 
+ std::string formatRow(uint32_t cacheSize, uint32_t blockSize,
+                       uint32_t associativity, bool writeBack,
+                       bool writeAllocate, float missRate,
+                       uint64_t totalCycles,
+                       ReplacementPolicy::Kind replacement) {
+   std::ostringstream row;
+   row << cacheSize << "," << blockSize << "," << associativity << ","
+       << writeBack << "," << writeAllocate << "," << missRate << ","
+       << totalCycles << "," << ReplacementPolicy::getKindName(replacement)
+       << std::endl;
+   return row.str();
+ }
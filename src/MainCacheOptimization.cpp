@@ -14,14 +14,20 @@
  #include "Cache.h"
  #include "Debug.h"
  #include "MemoryManager.h"
+ #include "Trace.h"
  
  bool parseParameters(int argc, char **argv);
  void printUsage();
+ void computeNextUse(TraceReader &trace, uint32_t blockSize,
+                     std::vector<uint32_t> &nextUse);
  
  const char *traceFilePath;
+ bool optL1 = false;
+ Cache::Inclusion inclusion = Cache::NINE;
  
  int main(int argc, char **argv) {
    if (!parseParameters(argc, argv)) {
+     printUsage();
      return -1;
    }
  
@@ -32,12 +38,27 @@
    l1policy.associativity = 8;
    l1policy.hitLatency = 2;
    l1policy.missLatency = 8;
+   l1policy.flatLatency = false;
+   l1policy.replacement =
+       optL1 ? ReplacementPolicy::OPT : ReplacementPolicy::LRU;
+   l1policy.prefetcher = Prefetcher::NONE;
+   l1policy.mshrNum = 0;
+   l1policy.writeBufferSize = 0;
+   l1policy.predictBypass = false;
+   l1policy.inclusion = Cache::NINE;
    l2policy.cacheSize = 256 * 1024;
    l2policy.blockSize = 64;
    l2policy.blockNum = 256 * 1024 / 64;
    l2policy.associativity = 8;
    l2policy.hitLatency = 8;
    l2policy.missLatency = 100;
+   l2policy.flatLatency = false;
+   l2policy.replacement = ReplacementPolicy::LRU;
+   l2policy.prefetcher = Prefetcher::NONE;
+   l2policy.mshrNum = 0;
+   l2policy.writeBufferSize = 0;
+   l2policy.predictBypass = false;
+   l2policy.inclusion = inclusion;
  
    // Initialize memory and cache
    MemoryManager *memory = nullptr;
@@ -48,25 +69,30 @@
    memory->setCache(l1cache);
  
    // Read and execute trace in cache-trace/ folder
-   std::ifstream trace(traceFilePath);
-   if (!trace.is_open()) {
+   TraceReader trace;
+   if (!trace.open(traceFilePath)) {
      printf("Unable to open file %s\n", traceFilePath);
      exit(-1);
    }
  
-   char type; //'r' for read, 'w' for write
-   uint32_t addr;
-   while (trace >> type >> std::hex >> addr) {
-     switch (type) {
-     case 'r':
-       memory->getByte(addr);
-       break;
-     case 'w':
-       memory->setByte(addr, 0);
-       break;
-     default:
-       dbgprintf("Illegal type %c\n", type);
-       exit(-1);
+   // OPT in L1 needs a first pass to find the next use of every line access
+   std::vector<uint32_t> nextUse;
+   if (optL1) {
+     computeNextUse(trace, l1policy.blockSize, nextUse);
+     l1cache->setNextUse(&nextUse);
+     trace.open(traceFilePath);
+   }
+ 
+   TraceRecord record;
+   while (trace.next(record)) {
+     // Accesses wider than a word are split into words
+     for (uint32_t i = 0; i < record.size; i += 4) {
+       uint32_t len = record.size - i < 4 ? record.size - i : 4;
+       if (record.isWrite) {
+         memory->write(record.addr + i, len, 0);
+       } else {
+         memory->read(record.addr + i, len);
+       }
      }
    }
  
@@ -82,12 +108,48 @@
  
  bool parseParameters(int argc, char **argv) {
    // Read Parameters
-   if (argc > 1) {
-     traceFilePath = argv[1];
-     return true;
-   } else {
-     return false;
+   for (int i = 1; i < argc; ++i) {
+     if (argv[i][0] == '-') {
+       if (argv[i][1] == 'o') {
+         optL1 = true;
+       } else if (argv[i][1] == 'H' && i + 1 < argc) {
+         if (!Cache::parseInclusion(argv[++i], &inclusion)) {
+           return false;
+         }
+       } else {
+         return false;
+       }
+     } else if (traceFilePath == nullptr) {
+       traceFilePath = argv[i];
+     } else {
+       return false;
+     }
    }
+   return traceFilePath != nullptr;
  }
  
- void printUsage() { printf("Usage: CacheSim trace-file\n"); }
\ No newline at end of file
+ void printUsage() {
+   printf("Usage: CacheOptimized trace-file [-o] [-H inclusion]\n");
+   printf("Parameters: -o Belady OPT replacement in L1, -H inclusion of L2 "
+          "towards L1, NINE, Inclusive or Exclusive, default NINE\n");
+ }
+ 
+ // The L1 line accesses, in the order the main loop below makes them
+ void computeNextUse(TraceReader &trace, uint32_t blockSize,
+                     std::vector<uint32_t> &nextUse) {
+   std::vector<uint32_t> lines;
+   TraceRecord record;
+   while (trace.next(record)) {
+     for (uint32_t i = 0; i < record.size; i += 4) {
+       uint32_t len = record.size - i < 4 ? record.size - i : 4;
+       uint32_t first = (record.addr + i) & ~(blockSize - 1);
+       uint32_t last = (record.addr + i + len - 1) & ~(blockSize - 1);
+       for (uint32_t line = first;; line += blockSize) {
+         lines.push_back(line);
+         if (line == last)
+           break;
+       }
+     }
+   }
+   nextUse = OPTPolicy::computeNextUse(lines);
+ }
\ No newline at end of file
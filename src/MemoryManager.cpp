@@ -5,27 +5,51 @@
  #include "MemoryManager.h"
  #include "Debug.h"
 
+ #include <algorithm>
  #include <cstdio>
+ #include <cstring>
  #include <string>
 
  MemoryManager::MemoryManager() {
    this->cache = nullptr;
-   this->memory = new uint8_t[UINT32_MAX];
-   memset(this->memory, 0, UINT32_MAX);
+   this->instCache = nullptr;
+   for (uint32_t i = 0; i < 1024; ++i) {
+     this->memory[i] = nullptr;
+   }
  }
 
  MemoryManager::~MemoryManager() {
-   delete[] this->memory;
+   for (uint32_t i = 0; i < 1024; ++i) {
+     if (this->memory[i] == nullptr) {
+       continue;
+     }
+     for (uint32_t j = 0; j < 1024; ++j) {
+       delete[] this->memory[i][j];
+     }
+     delete[] this->memory[i];
+     this->memory[i] = nullptr;
+   }
  }
 
  bool MemoryManager::addPage(uint32_t addr) {
-   dbgprintf("addPage() called but paging is disabled.\n");
+   uint32_t i = this->getFirstEntryId(addr);
+   uint32_t j = this->getSecondEntryId(addr);
+   if (this->memory[i] == nullptr) {
+     this->memory[i] = new uint8_t *[1024];
+     memset(this->memory[i], 0, sizeof(uint8_t *) * 1024);
+   }
+   if (this->memory[i][j] != nullptr) {
+     return false;
+   }
+   this->memory[i][j] = new uint8_t[4096];
+   memset(this->memory[i][j], 0, 4096);
    return true;
  }
 
  bool MemoryManager::isPageExist(uint32_t addr) {
-   dbgprintf("isPageExist() called but paging is disabled.\n");
-   return true;
+   uint32_t i = this->getFirstEntryId(addr);
+   uint32_t j = this->getSecondEntryId(addr);
+   return this->memory[i] != nullptr && this->memory[i][j] != nullptr;
  }
 
  bool MemoryManager::copyFrom(const void *src, uint32_t dest, uint32_t len) {
@@ -49,7 +73,7 @@
      return true;
    }
 
-   this->memory[addr] = val;
+   this->getPage(addr, true)[this->getPageOffset(addr)] = val;
    return true;
  }
 
@@ -59,7 +83,7 @@
      return false;
    }
 
-   this->memory[addr] = val;
+   this->getPage(addr, true)[this->getPageOffset(addr)] = val;
    return true;
  }
 
@@ -71,7 +95,7 @@
    if (this->cache != nullptr) {
      return this->cache->getByte(addr, cycles);
    }
-   return this->memory[addr];
+   return this->getByteNoCache(addr);
  }
 
  uint8_t MemoryManager::getByteNoCache(uint32_t addr) {
@@ -79,48 +103,126 @@
      dbgprintf("Byte read to invalid addr 0x%x!\n", addr);
      return false;
    }
-   return this->memory[addr];
+   const uint8_t *page = this->getPage(addr, false);
+   return page == nullptr ? 0 : page[this->getPageOffset(addr)];
  }
 
  bool MemoryManager::setShort(uint32_t addr, uint16_t val, uint32_t *cycles) {
-   if (!this->isAddrExist(addr)) {
-     dbgprintf("Short write to invalid addr 0x%x!\n", addr);
-     return false;
-   }
-   this->setByte(addr, val & 0xFF, cycles);
-   this->setByte(addr + 1, (val >> 8) & 0xFF);
-   return true;
+   return this->write(addr, 2, val, cycles);
  }
 
  uint16_t MemoryManager::getShort(uint32_t addr, uint32_t *cycles) {
-   uint32_t b1 = this->getByte(addr, cycles);
-   uint32_t b2 = this->getByte(addr + 1);
-   return b1 + (b2 << 8);
+   return this->read(addr, 2, cycles);
  }
 
  bool MemoryManager::setInt(uint32_t addr, uint32_t val, uint32_t *cycles) {
+   return this->write(addr, 4, val, cycles);
+ }
+
+ uint32_t MemoryManager::getInt(uint32_t addr, uint32_t *cycles) {
+   return this->read(addr, 4, cycles);
+ }
+
+ bool MemoryManager::write(uint32_t addr, uint32_t len, uint32_t val,
+                           uint32_t *cycles) {
    if (!this->isAddrExist(addr)) {
-     dbgprintf("Int write to invalid addr 0x%x!\n", addr);
+     dbgprintf("Write of %u bytes to invalid addr 0x%x!\n", len, addr);
      return false;
    }
-   this->setByte(addr, val & 0xFF, cycles);
-   this->setByte(addr + 1, (val >> 8) & 0xFF);
-   this->setByte(addr + 2, (val >> 16) & 0xFF);
-   this->setByte(addr + 3, (val >> 24) & 0xFF);
+   if (this->cache != nullptr) {
+     this->cache->write(addr, len, val, cycles);
+     return true;
+   }
+
+   uint8_t data[4];
+   for (uint32_t i = 0; i < len; ++i) {
+     data[i] = (val >> (8 * i)) & 0xFF;
+   }
+   this->writeBlockNoCache(addr, len, data);
    return true;
  }
 
- uint32_t MemoryManager::getInt(uint32_t addr, uint32_t *cycles) {
-   uint32_t b1 = this->getByte(addr, cycles);
-   uint32_t b2 = this->getByte(addr + 1);
-   uint32_t b3 = this->getByte(addr + 2);
-   uint32_t b4 = this->getByte(addr + 3);
-   return b1 + (b2 << 8) + (b3 << 16) + (b4 << 24);
+ uint32_t MemoryManager::read(uint32_t addr, uint32_t len, uint32_t *cycles) {
+   if (!this->isAddrExist(addr)) {
+     dbgprintf("Read of %u bytes to invalid addr 0x%x!\n", len, addr);
+     return false;
+   }
+   if (this->cache != nullptr) {
+     return this->cache->read(addr, len, cycles);
+   }
+
+   uint8_t data[4];
+   this->readBlockNoCache(addr, len, data);
+   uint32_t val = 0;
+   for (uint32_t i = 0; i < len; ++i) {
+     val |= uint32_t(data[i]) << (8 * i);
+   }
+   return val;
+ }
+
+ uint32_t MemoryManager::fetch(uint32_t addr, uint32_t *cycles) {
+   if (this->instCache == nullptr) {
+     return this->read(addr, 4, cycles);
+   }
+   uint8_t data[4];
+   this->instCache->read(addr, 4, cycles);
+   if (this->cache != nullptr) {
+     this->cache->peekBlock(addr, 4, data);
+   } else {
+     this->readBlockNoCache(addr, 4, data);
+   }
+   uint32_t val = 0;
+   for (uint32_t i = 0; i < 4; ++i) {
+     val |= uint32_t(data[i]) << (8 * i);
+   }
+   return val;
+ }
+
+ void MemoryManager::writeBlockNoCache(uint32_t addr, uint32_t len,
+                                       const uint8_t *data) {
+   // Copy page by page, a block may straddle a page boundary
+   while (len > 0) {
+     uint32_t offset = this->getPageOffset(addr);
+     uint32_t chunk = std::min(len, 4096 - offset);
+     memcpy(this->getPage(addr, true) + offset, data, chunk);
+     addr += chunk;
+     data += chunk;
+     len -= chunk;
+   }
+ }
+
+ void MemoryManager::readBlockNoCache(uint32_t addr, uint32_t len,
+                                      uint8_t *data) {
+   while (len > 0) {
+     uint32_t offset = this->getPageOffset(addr);
+     uint32_t chunk = std::min(len, 4096 - offset);
+     const uint8_t *page = this->getPage(addr, false);
+     if (page == nullptr) {
+       memset(data, 0, chunk);
+     } else {
+       memcpy(data, page + offset, chunk);
+     }
+     addr += chunk;
+     data += chunk;
+     len -= chunk;
+   }
  }
 
  void MemoryManager::printInfo() {
    printf("Memory Info: \n");
-   printf("Single large page covering the entire address space.\n");
+   printf("Two-level page table, pages allocated on first write.\n");
+   uint32_t pageCount = 0;
+   for (uint32_t i = 0; i < 1024; ++i) {
+     if (this->memory[i] == nullptr) {
+       continue;
+     }
+     for (uint32_t j = 0; j < 1024; ++j) {
+       if (this->memory[i][j] != nullptr) {
+         pageCount++;
+       }
+     }
+   }
+   printf("%u pages (%u KiB) allocated.\n", pageCount, pageCount * 4);
  }
 
  void MemoryManager::printStatistics() {
@@ -128,38 +230,136 @@
    this->cache->printStatistics();
  }
 
+ void MemoryManager::resetStatistics() {
+   if (this->cache != nullptr) {
+     this->cache->resetStatistics();
+   }
+   if (this->instCache != nullptr) {
+     this->instCache->resetStatistics();
+   }
+ }
+
  std::string MemoryManager::dumpMemory() {
    char buf[65536];
    std::string dump;
 
    dump += "Memory Dump: \n";
-   for (uint32_t addr = 0; addr < UINT32_MAX; addr += 4096) {
-     sprintf(buf, "0x%x-0x%x\n", addr, addr + 4096);
-     dump += buf;
-     for (uint32_t offset = 0; offset < 4096; ++offset) {
-       sprintf(buf, "  0x%x: 0x%x\n", addr + offset, this->memory[addr + offset]);
+   for (uint32_t i = 0; i < 1024; ++i) {
+     if (this->memory[i] == nullptr) {
+       continue;
+     }
+     for (uint32_t j = 0; j < 1024; ++j) {
+       if (this->memory[i][j] == nullptr) {
+         continue;
+       }
+       uint32_t addr = (i << 22) | (j << 12);
+       sprintf(buf, "0x%x-0x%x\n", addr, addr + 4096);
        dump += buf;
+       for (uint32_t offset = 0; offset < 4096; ++offset) {
+         sprintf(buf, "  0x%x: 0x%x\n", addr + offset,
+                 this->memory[i][j][offset]);
+         dump += buf;
+       }
      }
    }
    return dump;
  }
 
+ bool MemoryManager::saveState(FILE *file) {
+   if (this->cache != nullptr) {
+     this->cache->syncMemory();
+   }
+   uint32_t pageCount = 0;
+   for (uint32_t i = 0; i < 1024; ++i) {
+     if (this->memory[i] == nullptr) {
+       continue;
+     }
+     for (uint32_t j = 0; j < 1024; ++j) {
+       if (this->memory[i][j] != nullptr) {
+         pageCount++;
+       }
+     }
+   }
+   if (fwrite(&pageCount, 4, 1, file) != 1) {
+     return false;
+   }
+   for (uint32_t i = 0; i < 1024; ++i) {
+     if (this->memory[i] == nullptr) {
+       continue;
+     }
+     for (uint32_t j = 0; j < 1024; ++j) {
+       if (this->memory[i][j] == nullptr) {
+         continue;
+       }
+       uint32_t addr = (i << 22) | (j << 12);
+       if (fwrite(&addr, 4, 1, file) != 1 ||
+           fwrite(this->memory[i][j], 1, 4096, file) != 4096) {
+         return false;
+       }
+     }
+   }
+   return true;
+ }
+
+ bool MemoryManager::loadState(FILE *file) {
+   uint32_t pageCount;
+   if (fread(&pageCount, 4, 1, file) != 1) {
+     return false;
+   }
+   for (uint32_t i = 0; i < pageCount; ++i) {
+     uint32_t addr;
+     if (fread(&addr, 4, 1, file) != 1 || (addr & 0xFFF) != 0) {
+       return false;
+     }
+     if (fread(this->getPage(addr, true), 1, 4096, file) != 4096) {
+       return false;
+     }
+   }
+   return true;
+ }
+
  uint32_t MemoryManager::getFirstEntryId(uint32_t addr) {
-   return 0;
+   return (addr >> 22) & 0x3FF;
  }
 
  uint32_t MemoryManager::getSecondEntryId(uint32_t addr) {
-   return 0;
+   return (addr >> 12) & 0x3FF;
  }
 
  uint32_t MemoryManager::getPageOffset(uint32_t addr) {
-   return addr;
+   return addr & 0xFFF;
  }
 
+ // The whole 32-bit address space is addressable; pages that were never
+ // written read as zero and are only backed by host memory on first write.
  bool MemoryManager::isAddrExist(uint32_t addr) {
-   return addr < UINT32_MAX;
+   return true;
+ }
+
+ uint8_t *MemoryManager::getPage(uint32_t addr, bool allocate) {
+   uint32_t i = this->getFirstEntryId(addr);
+   uint32_t j = this->getSecondEntryId(addr);
+   if (this->memory[i] == nullptr || this->memory[i][j] == nullptr) {
+     if (!allocate) {
+       return nullptr;
+     }
+     this->addPage(addr);
+   }
+   return this->memory[i][j];
  }
 
  void MemoryManager::setCache(Cache *cache) {
    this->cache = cache;
  }
+
+ Cache *MemoryManager::getCache() { return this->cache; }
+
+ void MemoryManager::setInstCache(Cache *cache) {
+   // Fetches read their data through the data cache
+   if (cache != nullptr) {
+     cache->setTimingOnly();
+   }
+   this->instCache = cache;
+ }
+
+ Cache *MemoryManager::getInstCache() { return this->instCache; }
@@ -37,21 +37,48 @@ public:
   bool setInt(uint32_t addr, uint32_t val, uint32_t *cycles = nullptr);
   uint32_t getInt(uint32_t addr, uint32_t *cycles = nullptr);
 
+  // Little-endian access of len (1, 2 or 4) bytes as a single request
+  bool write(uint32_t addr, uint32_t len, uint32_t val,
+             uint32_t *cycles = nullptr);
+  uint32_t read(uint32_t addr, uint32_t len, uint32_t *cycles = nullptr);
+
+  // Instruction fetch. With an instruction cache set, the latency comes
+  // from it while the word is read coherently from the data side, so
+  // stores to code are seen at once. Otherwise this is a data read.
+  uint32_t fetch(uint32_t addr, uint32_t *cycles = nullptr);
+
+  // Bulk copies bypassing the cache, used for cache fills and writebacks
+  void writeBlockNoCache(uint32_t addr, uint32_t len, const uint8_t *data);
+  void readBlockNoCache(uint32_t addr, uint32_t len, uint8_t *data);
+
   void printInfo();
   void printStatistics();
+  void resetStatistics();
 
   std::string dumpMemory();
 
+  // Allocated pages for checkpoints, with dirty cache lines merged in
+  bool saveState(FILE *file);
+  bool loadState(FILE *file);
+
   void setCache(Cache *cache);
+  Cache *getCache();
+  // The instruction cache only supplies fetch timing, see
+  // Cache::setTimingOnly
+  void setInstCache(Cache *cache);
+  Cache *getInstCache();
 
 private:
   uint32_t getFirstEntryId(uint32_t addr);
   uint32_t getSecondEntryId(uint32_t addr);
   uint32_t getPageOffset(uint32_t addr);
   bool isAddrExist(uint32_t addr);
+  uint8_t *getPage(uint32_t addr, bool allocate);
 
-  uint8_t *memory;
+  // Two-level page table of 1024 x 1024 pages of 4 KiB each
+  uint8_t **memory[1024];
   Cache *cache;
+  Cache *instCache; // nullptr when fetches share the data cache
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+/*
+ * Implementation of the per-PC cycle attribution profiler
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include "PCProfiler.h"
+
+PCProfiler::PCProfiler() {
+  this->file = nullptr;
+  for (int i = 0; i < 1024; ++i) {
+    this->table[i] = nullptr;
+  }
+  this->pendingStall = 0;
+  this->symbolsSorted = true;
+}
+
+PCProfiler::~PCProfiler() {
+  this->close();
+  for (int i = 0; i < 1024; ++i) {
+    if (this->table[i] == nullptr) {
+      continue;
+    }
+    for (int j = 0; j < 1024; ++j) {
+      delete[] this->table[i][j];
+    }
+    delete[] this->table[i];
+  }
+}
+
+bool PCProfiler::open(const char *path) {
+  this->close();
+  this->file = fopen(path, "w");
+  return this->file != nullptr;
+}
+
+bool PCProfiler::close() {
+  if (this->file == nullptr) {
+    return true;
+  }
+  fprintf(this->file, "pc,function,offset,count,cycles,stall_cycles,"
+                      "memory_cycles,execute_cycles,mispredictions\n");
+  for (const Row &row : this->getSortedRows()) {
+    const Symbol *symbol = this->findSymbol(row.pc);
+    const Entry &entry = *row.entry;
+    fprintf(this->file,
+            "0x%x,%s,%u,%" PRIu64 ",%" PRId64 ",%" PRId64 ",%" PRIu64
+            ",%" PRIu64 ",%" PRIu64 "\n",
+            row.pc, symbol != nullptr ? symbol->name.c_str() : "",
+            symbol != nullptr ? row.pc - symbol->addr : 0, entry.count,
+            entry.cycles, entry.stallCycles, entry.memoryCycles,
+            entry.executeCycles, entry.mispredictions);
+  }
+  bool good = fclose(this->file) == 0;
+  this->file = nullptr;
+  return good;
+}
+
+void PCProfiler::addSymbol(uint32_t addr, uint32_t size,
+                           const std::string &name) {
+  Symbol symbol;
+  symbol.addr = addr;
+  symbol.size = size;
+  symbol.name = name;
+  this->symbols.push_back(symbol);
+  this->symbolsSorted = false;
+}
+
+void PCProfiler::flush(uint32_t pc) {
+  this->addStallCycles(pc, this->pendingStall);
+  this->pendingStall = 0;
+}
+
+PCProfiler::Entry &PCProfiler::allocateEntry(uint32_t pc) {
+  Entry **&second = this->table[pc >> 22];
+  if (second == nullptr) {
+    second = new Entry *[1024];
+    memset(second, 0, sizeof(Entry *) * 1024);
+  }
+  Entry *&page = second[(pc >> 12) & 0x3FF];
+  if (page == nullptr) {
+    page = new Entry[1024];
+    memset(page, 0, sizeof(Entry) * 1024);
+  }
+  return page[(pc >> 2) & 0x3FF];
+}
+
+std::vector<PCProfiler::Row> PCProfiler::getSortedRows() {
+  std::vector<Row> rows;
+  for (uint32_t i = 0; i < 1024; ++i) {
+    if (this->table[i] == nullptr) {
+      continue;
+    }
+    for (uint32_t j = 0; j < 1024; ++j) {
+      if (this->table[i][j] == nullptr) {
+        continue;
+      }
+      for (uint32_t k = 0; k < 1024; ++k) {
+        const Entry &entry = this->table[i][j][k];
+        if (entry.count == 0 && entry.cycles == 0 &&
+            entry.mispredictions == 0) {
+          continue;
+        }
+        Row row;
+        row.pc = (i << 22) | (j << 12) | (k << 2);
+        row.entry = &entry;
+        rows.push_back(row);
+      }
+    }
+  }
+  std::stable_sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) {
+    return a.entry->cycles > b.entry->cycles;
+  });
+  return rows;
+}
+
+const PCProfiler::Symbol *PCProfiler::findSymbol(uint32_t pc) {
+  if (!this->symbolsSorted) {
+    std::sort(this->symbols.begin(), this->symbols.end(),
+              [](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+    this->symbolsSorted = true;
+  }
+  // Last symbol starting at or below pc
+  auto it = std::upper_bound(
+      this->symbols.begin(), this->symbols.end(), pc,
+      [](uint32_t addr, const Symbol &symbol) { return addr < symbol.addr; });
+  if (it == this->symbols.begin()) {
+    return nullptr;
+  }
+  --it;
+  if (it->size != 0 && pc >= it->addr + it->size) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+std::string PCProfiler::getLocation(uint32_t pc) {
+  const Symbol *symbol = this->findSymbol(pc);
+  if (symbol == nullptr) {
+    return "?";
+  }
+  char buf[32];
+  sprintf(buf, "+0x%x", pc - symbol->addr);
+  return symbol->name + buf;
+}
+
+void PCProfiler::printReport(uint32_t topNum) {
+  std::vector<Row> rows = this->getSortedRows();
+  int64_t totalCycles = 0;
+  std::map<std::string, Entry> functions;
+  for (const Row &row : rows) {
+    totalCycles += row.entry->cycles;
+    const Symbol *symbol = this->findSymbol(row.pc);
+    Entry &function = functions[symbol != nullptr ? symbol->name : "?"];
+    function.count += row.entry->count;
+    function.cycles += row.entry->cycles;
+    function.stallCycles += row.entry->stallCycles;
+    function.memoryCycles += row.entry->memoryCycles;
+    function.executeCycles += row.entry->executeCycles;
+    function.mispredictions += row.entry->mispredictions;
+  }
+  std::vector<std::pair<std::string, Entry>> functionRows(functions.begin(),
+                                                          functions.end());
+  std::stable_sort(functionRows.begin(), functionRows.end(),
+                   [](const std::pair<std::string, Entry> &a,
+                      const std::pair<std::string, Entry> &b) {
+                     return a.second.cycles > b.second.cycles;
+                   });
+  double total = totalCycles > 0 ? totalCycles : 1;
+
+  printf("------------- PROFILE -------------\n");
+  printf("%-20s %10s %6s %8s %10s %10s %10s %8s\n", "Function", "Cycles", "%",
+         "CPI", "Stall", "Memory", "Execute", "Mispred");
+  for (size_t i = 0; i < functionRows.size() && i < topNum; ++i) {
+    const Entry &entry = functionRows[i].second;
+    printf("%-20s %10" PRId64 " %6.2f %8.4f %10" PRId64 " %10" PRIu64
+           " %10" PRIu64 " %8" PRIu64 "\n",
+           functionRows[i].first.c_str(), entry.cycles,
+           100.0 * entry.cycles / total,
+           entry.count > 0 ? (double)entry.cycles / entry.count : 0.0,
+           entry.stallCycles, entry.memoryCycles, entry.executeCycles,
+           entry.mispredictions);
+  }
+  printf("\n");
+  printf("%-10s %-20s %10s %10s %6s %8s %10s %10s %10s %8s\n", "PC",
+         "Location", "Count", "Cycles", "%", "CPI", "Stall", "Memory",
+         "Execute", "Mispred");
+  for (size_t i = 0; i < rows.size() && i < topNum; ++i) {
+    const Entry &entry = *rows[i].entry;
+    printf("0x%-8x %-20s %10" PRIu64 " %10" PRId64 " %6.2f %8.4f %10" PRId64
+           " %10" PRIu64 " %10" PRIu64 " %8" PRIu64 "\n",
+           rows[i].pc, this->getLocation(rows[i].pc).c_str(), entry.count,
+           entry.cycles, 100.0 * entry.cycles / total,
+           entry.count > 0 ? (double)entry.cycles / entry.count : 0.0,
+           entry.stallCycles, entry.memoryCycles, entry.executeCycles,
+           entry.mispredictions);
+  }
+  printf("-----------------------------------\n");
+}
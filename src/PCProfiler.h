@@ -0,0 +1,110 @@
+/*
+ * Per-PC cycle attribution for the pipelined simulator
+ *
+ * Every simulated cycle is charged to exactly one instruction, so the
+ * cycles of all PCs add up to the total cycle count:
+ *   - a cycle in which an instruction writes back is its base cycle
+ *   - a cycle in which no instruction writes back is a stall cycle of the
+ *     next instruction to write back, the one that was held up
+ *   - memory latency and multi-cycle execution are charged to the
+ *     instruction that caused them
+ * Branch mispredictions are counted at the branch. PCs are grouped into
+ * functions with the ELF symbol table.
+ */
+
+#ifndef PC_PROFILER_H
+#define PC_PROFILER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class PCProfiler {
+public:
+  struct Entry {
+    uint64_t count; // number of times executed
+    int64_t cycles;
+    int64_t stallCycles;
+    uint64_t memoryCycles;
+    uint64_t executeCycles;
+    uint64_t mispredictions;
+  };
+
+  PCProfiler();
+  ~PCProfiler();
+  PCProfiler(const PCProfiler &) = delete;
+  PCProfiler &operator=(const PCProfiler &) = delete;
+
+  bool open(const char *path);
+  // Writes one CSV row per PC, sorted by cycles
+  bool close();
+
+  // Symbols of size 0 extend to the next symbol
+  void addSymbol(uint32_t addr, uint32_t size, const std::string &name);
+
+  void retire(uint32_t pc) {
+    Entry &entry = this->getEntry(pc);
+    entry.count++;
+    entry.cycles += 1 + this->pendingStall;
+    entry.stallCycles += this->pendingStall;
+    this->pendingStall = 0;
+  }
+  void stallCycle() { this->pendingStall++; }
+  void addStallCycles(uint32_t pc, int32_t cycles) {
+    Entry &entry = this->getEntry(pc);
+    entry.cycles += cycles;
+    entry.stallCycles += cycles;
+  }
+  void addMemoryCycles(uint32_t pc, uint32_t cycles) {
+    Entry &entry = this->getEntry(pc);
+    entry.cycles += cycles;
+    entry.memoryCycles += cycles;
+  }
+  void addExecuteCycles(uint32_t pc, uint32_t cycles) {
+    Entry &entry = this->getEntry(pc);
+    entry.cycles += cycles;
+    entry.executeCycles += cycles;
+  }
+  void mispredict(uint32_t pc) { this->getEntry(pc).mispredictions++; }
+  // Charges stall cycles not yet followed by a write back to pc
+  void flush(uint32_t pc);
+
+  // Prints the topNum functions and PCs with the most cycles
+  void printReport(uint32_t topNum);
+
+private:
+  struct Symbol {
+    uint32_t addr;
+    uint32_t size;
+    std::string name;
+  };
+  struct Row {
+    uint32_t pc;
+    const Entry *entry;
+  };
+
+  FILE *file;
+  // Entries by PC, a two-level table of 4 KiB pages allocated on first use
+  Entry **table[1024];
+  int64_t pendingStall;
+  std::vector<Symbol> symbols; // sorted by address when looked up
+  bool symbolsSorted;
+
+  Entry &getEntry(uint32_t pc) {
+    Entry **second = this->table[pc >> 22];
+    if (second != nullptr) {
+      Entry *page = second[(pc >> 12) & 0x3FF];
+      if (page != nullptr) {
+        return page[(pc >> 2) & 0x3FF];
+      }
+    }
+    return this->allocateEntry(pc);
+  }
+  Entry &allocateEntry(uint32_t pc);
+  std::vector<Row> getSortedRows();
+  const Symbol *findSymbol(uint32_t pc);
+  std::string getLocation(uint32_t pc);
+};
+
+#endif
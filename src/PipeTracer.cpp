@@ -0,0 +1,235 @@
+/*
+ * Implementation of the pipeline timeline writer
+ */
+
+#include <cstring>
+
+#include "PipeTracer.h"
+
+namespace {
+
+const char STAGENAME[] = "FDXMW";
+
+// Fixed strings are copied with a constant length
+template <size_t N> inline char *putString(char *out, const char (&str)[N]) {
+  memcpy(out, str, N - 1);
+  return out + N - 1;
+}
+
+inline char *putDecimal(char *out, uint64_t val) {
+  uint32_t len = 1;
+  for (uint64_t rest = val; rest >= 10; rest /= 10) {
+    len++;
+  }
+  char *end = out + len;
+  out = end;
+  do {
+    *--out = '0' + val % 10;
+    val /= 10;
+  } while (val != 0);
+  return end;
+}
+
+inline char *putHex(char *out, uint32_t val) {
+  static const char HEX[] = "0123456789abcdef";
+  for (int i = 7; i >= 0; --i) {
+    *out++ = HEX[(val >> (4 * i)) & 0xF];
+  }
+  return out;
+}
+
+// The whole idText is copied, a constant length copy is much cheaper and
+// MAX_RECORD leaves room for it
+inline char *putId(char *out, const char (&text)[12], uint32_t len) {
+  memcpy(out, text, sizeof(text));
+  return out + len;
+}
+
+} // namespace
+
+PipeTracer::PipeTracer() {
+  this->file = nullptr;
+  this->buffer = nullptr;
+  this->pos = 0;
+  this->cycle = 0;
+  this->nextId = 1;
+  this->retired = 0;
+  this->liveNum = 0;
+}
+
+PipeTracer::~PipeTracer() {
+  this->close();
+  delete[] this->buffer;
+}
+
+bool PipeTracer::open(const char *path) {
+  this->close();
+  this->file = fopen(path, "w");
+  if (this->file == nullptr) {
+    return false;
+  }
+  if (this->buffer == nullptr) {
+    this->buffer = new char[BUFFER_SIZE];
+  }
+  this->pos = 0;
+  this->cycle = uint64_t(-1);
+  this->nextId = 1;
+  this->retired = 0;
+  this->liveNum = 0;
+  this->end(putString(this->begin(MAX_RECORD), "Kanata\t0004\n"));
+  return true;
+}
+
+bool PipeTracer::close() {
+  if (this->file == nullptr) {
+    return true;
+  }
+  // Instructions still in flight are left open
+  this->flushBuffer();
+  bool good = fclose(this->file) == 0;
+  this->file = nullptr;
+  return good;
+}
+
+void PipeTracer::beginCycle(uint64_t cycle) {
+  char *out = this->begin(MAX_RECORD);
+  if (this->cycle == uint64_t(-1)) {
+    out = putString(out, "C=\t");
+    out = putDecimal(out, cycle);
+    *out++ = '\n';
+  } else if (cycle > this->cycle) {
+    out = putString(out, "C\t");
+    out = putDecimal(out, cycle - this->cycle);
+    *out++ = '\n';
+  }
+  this->end(out);
+  this->cycle = cycle;
+  for (int i = 0; i < this->liveNum; ++i) {
+    this->live[i].seen = false;
+  }
+}
+
+void PipeTracer::endCycle() {
+  int kept = 0;
+  for (int i = 0; i < this->liveNum; ++i) {
+    if (this->live[i].seen) {
+      this->live[kept++] = this->live[i];
+    } else {
+      this->close(this->live[i]);
+    }
+  }
+  this->liveNum = kept;
+}
+
+uint32_t PipeTracer::fetch(uint32_t pc) {
+  if (this->liveNum == MAX_LIVE) {
+    // Only reachable if the simulator stops reporting a stage, close the
+    // oldest instruction as flushed
+    this->live[0].seen = false;
+    this->endCycle();
+  }
+  uint32_t id = this->nextId++;
+  Live &entry = this->live[this->liveNum++];
+  entry.id = id;
+  entry.stage = STAGE_FETCH;
+  entry.seen = true;
+  entry.idLen = putDecimal(entry.idText, id) - entry.idText;
+
+  char *out = this->begin(MAX_RECORD);
+  out = putString(out, "I\t");
+  out = putId(out, entry.idText, entry.idLen);
+  *out++ = '\t';
+  out = putId(out, entry.idText, entry.idLen);
+  out = putString(out, "\t0\nL\t");
+  out = putId(out, entry.idText, entry.idLen);
+  out = putString(out, "\t0\t");
+  out = putHex(out, pc);
+  out = putString(out, ": \nS\t");
+  out = putId(out, entry.idText, entry.idLen);
+  out = putString(out, "\t0\tF\n");
+  this->end(out);
+  return id;
+}
+
+bool PipeTracer::stage(uint32_t id, Stage stage) {
+  Live *entry = this->findLive(id);
+  if (entry == nullptr) {
+    return false;
+  }
+  entry->seen = true;
+  if (entry->stage == stage) {
+    return true;
+  }
+  char *out = this->begin(MAX_RECORD);
+  out = putString(out, "E\t");
+  out = putId(out, entry->idText, entry->idLen);
+  out = putString(out, "\t0\t");
+  *out++ = STAGENAME[entry->stage];
+  out = putString(out, "\nS\t");
+  out = putId(out, entry->idText, entry->idLen);
+  out = putString(out, "\t0\t");
+  *out++ = STAGENAME[stage];
+  *out++ = '\n';
+  this->end(out);
+  entry->stage = stage;
+  return true;
+}
+
+void PipeTracer::label(uint32_t id, const char *text) {
+  size_t len = strlen(text);
+  char *out = this->begin(MAX_RECORD + len);
+  out = putString(out, "L\t");
+  out = putDecimal(out, id);
+  out = putString(out, "\t0\t");
+  memcpy(out, text, len);
+  out += len;
+  *out++ = '\n';
+  this->end(out);
+}
+
+void PipeTracer::forward(uint32_t consumer, uint32_t producer) {
+  char *out = this->begin(MAX_RECORD);
+  out = putString(out, "W\t");
+  out = putDecimal(out, consumer);
+  *out++ = '\t';
+  out = putDecimal(out, producer);
+  out = putString(out, "\t0\n");
+  this->end(out);
+}
+
+PipeTracer::Live *PipeTracer::findLive(uint32_t id) {
+  for (int i = 0; i < this->liveNum; ++i) {
+    if (this->live[i].id == id) {
+      return &this->live[i];
+    }
+  }
+  return nullptr;
+}
+
+// Ends the last stage, an instruction leaving from W retires and any other
+// is flushed
+void PipeTracer::close(Live &entry) {
+  bool retire = entry.stage == STAGE_WRITEBACK;
+  char *out = this->begin(MAX_RECORD);
+  out = putString(out, "E\t");
+  out = putId(out, entry.idText, entry.idLen);
+  out = putString(out, "\t0\t");
+  *out++ = STAGENAME[entry.stage];
+  out = putString(out, "\nR\t");
+  out = putId(out, entry.idText, entry.idLen);
+  if (retire) {
+    *out++ = '\t';
+    out = putDecimal(out, this->retired++);
+    out = putString(out, "\t0\n");
+  } else {
+    out = putString(out, "\t0\t1\n");
+  }
+  this->end(out);
+}
+
+void PipeTracer::flushBuffer() {
+  if (this->pos > 0) {
+    fwrite(this->buffer, 1, this->pos, this->file);
+    this->pos = 0;
+  }
+}
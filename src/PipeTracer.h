@@ -0,0 +1,94 @@
+/*
+ * Pipeline timeline writer for the pipelined simulator
+ *
+ * The timeline is written in the Kanata log format read by the Konata
+ * pipeline viewer. Each instruction gets a line with the cycles it spent in
+ * the F, D, X, M and W stages, ending either with a retire or a flush.
+ * Forwarding shows as a dependency arrow from producer to consumer.
+ *
+ * The simulator reports the fetched instructions and, once per cycle, the
+ * stage each in-flight instruction is in. Instructions that have left the
+ * pipeline since the previous cycle are retired if they were in W, and
+ * flushed otherwise.
+ */
+
+#ifndef PIPE_TRACER_H
+#define PIPE_TRACER_H
+
+#include <cstdint>
+#include <cstdio>
+
+class PipeTracer {
+public:
+  enum Stage {
+    STAGE_FETCH = 0,
+    STAGE_DECODE,
+    STAGE_EXECUTE,
+    STAGE_MEMORY,
+    STAGE_WRITEBACK,
+  };
+
+  PipeTracer();
+  ~PipeTracer();
+  PipeTracer(const PipeTracer &) = delete;
+  PipeTracer &operator=(const PipeTracer &) = delete;
+
+  bool open(const char *path);
+  bool close();
+
+  // Starts the stage reports of a cycle, cycles may be skipped
+  void beginCycle(uint64_t cycle);
+  // Retires or flushes the instructions not reported since beginCycle
+  void endCycle();
+
+  // Starts a new instruction in F, returns its id, never 0
+  uint32_t fetch(uint32_t pc);
+  // Reports the stage of an in-flight instruction, returns false if the id
+  // is no longer in flight
+  bool stage(uint32_t id, Stage stage);
+  // Appends text to the label of an instruction
+  void label(uint32_t id, const char *text);
+  // Records that consumer got an operand forwarded from producer
+  void forward(uint32_t consumer, uint32_t producer);
+
+private:
+  // Enough for every pipeline register plus the instruction being fetched
+  static const int MAX_LIVE = 8;
+  static const uint32_t BUFFER_SIZE = 1 << 20;
+  // Longest record, the label text excluded
+  static const uint32_t MAX_RECORD = 128;
+
+  struct Live {
+    uint32_t id;
+    Stage stage;
+    bool seen; // reported in the current cycle
+    // The id in decimal, it is written in every record of the instruction
+    uint32_t idLen;
+    char idText[12];
+  };
+
+  FILE *file;
+  char *buffer;
+  uint32_t pos;
+  uint64_t cycle;
+  uint32_t nextId;
+  uint64_t retired;
+  Live live[MAX_LIVE];
+  int liveNum;
+
+  Live *findLive(uint32_t id);
+  void close(Live &entry);
+
+  // Records are formatted through a local cursor, stores through a char
+  // pointer would otherwise reload this->pos for every byte
+  char *begin(uint32_t len) {
+    if (this->pos + len > BUFFER_SIZE) {
+      this->flushBuffer();
+    }
+    return this->buffer + this->pos;
+  }
+  void end(char *out) { this->pos = out - this->buffer; }
+  void flushBuffer();
+};
+
+#endif
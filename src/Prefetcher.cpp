@@ -0,0 +1,198 @@
+/*
+ * Implementation of the hardware prefetchers
+ */
+
+#include <strings.h>
+
+#include "Prefetcher.h"
+
+namespace {
+
+const char *KINDNAME[] = {"None", "NextLine", "Stride", "Stream"};
+
+} // namespace
+
+Prefetcher *Prefetcher::create(Kind kind, uint32_t blockSize) {
+  switch (kind) {
+  case NEXT_LINE:
+    return new NextLinePrefetcher(blockSize);
+  case STRIDE:
+    return new StridePrefetcher(blockSize);
+  case STREAM:
+    return new StreamPrefetcher(blockSize);
+  default:
+    return nullptr;
+  }
+}
+
+bool Prefetcher::parseKind(const char *name, Kind *kind) {
+  for (int i = 0; i < KIND_NUM; ++i) {
+    if (strcasecmp(name, KINDNAME[i]) == 0) {
+      *kind = Kind(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *Prefetcher::getKindName(Kind kind) {
+  if (kind < 0 || kind >= KIND_NUM) {
+    return "Unknown";
+  }
+  return KINDNAME[kind];
+}
+
+Prefetcher::Prefetcher(uint32_t blockSize) { this->blockSize = blockSize; }
+
+NextLinePrefetcher::NextLinePrefetcher(uint32_t blockSize)
+    : Prefetcher(blockSize) {}
+
+void NextLinePrefetcher::observe(uint32_t addr, uint32_t pc, Outcome outcome,
+                                 std::vector<uint32_t> &prefetches) {
+  // Tagged next-line, a used prefetch triggers the next one so a sequential
+  // walk keeps one line ahead after its first miss
+  if (outcome != HIT) {
+    prefetches.push_back(this->getLine(addr) + this->blockSize);
+  }
+}
+
+StridePrefetcher::StridePrefetcher(uint32_t blockSize)
+    : Prefetcher(blockSize) {
+  for (uint32_t i = 0; i < TABLE_SIZE; ++i) {
+    this->table[i].pc = 0;
+    this->table[i].lastAddr = 0;
+    this->table[i].stride = 0;
+    this->table[i].confidence = 0;
+  }
+}
+
+void StridePrefetcher::observe(uint32_t addr, uint32_t pc, Outcome outcome,
+                               std::vector<uint32_t> &prefetches) {
+  if (pc == 0) {
+    return;
+  }
+  Entry &entry = this->table[(pc >> 2) % TABLE_SIZE];
+  if (entry.pc != pc) {
+    entry.pc = pc;
+    entry.lastAddr = addr;
+    entry.stride = 0;
+    entry.confidence = 0;
+    return;
+  }
+
+  int32_t stride = int32_t(addr - entry.lastAddr);
+  entry.lastAddr = addr;
+  if (stride == entry.stride && stride != 0) {
+    if (entry.confidence < CONFIDENCE_MAX) {
+      entry.confidence++;
+    }
+  } else if (entry.confidence > 0) {
+    entry.confidence--;
+  } else {
+    entry.stride = stride;
+  }
+  if (entry.confidence < CONFIDENCE_THRESHOLD) {
+    return;
+  }
+
+  // Strides shorter than a line would prefetch the same line repeatedly
+  uint32_t line = this->getLine(addr);
+  for (uint32_t i = 1; i <= STRIDE_DEGREE; ++i) {
+    uint32_t target = this->getLine(addr + uint32_t(entry.stride) * i);
+    if (target != line) {
+      prefetches.push_back(target);
+      line = target;
+    }
+  }
+}
+
+bool StridePrefetcher::saveState(FILE *file) {
+  return fwrite(this->table, sizeof(this->table), 1, file) == 1;
+}
+
+bool StridePrefetcher::loadState(FILE *file) {
+  return fread(this->table, sizeof(this->table), 1, file) == 1;
+}
+
+StreamPrefetcher::StreamPrefetcher(uint32_t blockSize)
+    : Prefetcher(blockSize) {
+  for (uint32_t i = 0; i < STREAM_NUM; ++i) {
+    this->streams[i].valid = false;
+  }
+  this->useCounter = 0;
+}
+
+void StreamPrefetcher::observe(uint32_t addr, uint32_t pc, Outcome outcome,
+                               std::vector<uint32_t> &prefetches) {
+  if (outcome == HIT) {
+    return;
+  }
+  uint32_t line = this->getLine(addr);
+  uint32_t window = STREAM_WINDOW * this->blockSize;
+
+  // Continue the stream this access falls into
+  Stream *stream = nullptr;
+  for (uint32_t i = 0; i < STREAM_NUM; ++i) {
+    Stream &s = this->streams[i];
+    if (!s.valid || line == s.lastLine) {
+      continue;
+    }
+    int32_t direction = line > s.lastLine ? 1 : -1;
+    uint32_t distance = direction > 0 ? line - s.lastLine : s.lastLine - line;
+    if (distance <= window &&
+        (s.direction == 0 || s.direction == direction)) {
+      if (s.direction == 0) {
+        s.direction = direction;
+        s.prefetchedLine = line;
+      }
+      stream = &s;
+      break;
+    }
+  }
+
+  if (stream == nullptr) {
+    // Allocate the least recently used stream, it needs a second nearby
+    // miss to learn its direction
+    stream = &this->streams[0];
+    for (uint32_t i = 0; i < STREAM_NUM; ++i) {
+      Stream &s = this->streams[i];
+      if (!s.valid) {
+        stream = &s;
+        break;
+      }
+      if (s.lastUse < stream->lastUse) {
+        stream = &s;
+      }
+    }
+    stream->valid = true;
+    stream->direction = 0;
+    stream->lastLine = line;
+    stream->lastUse = ++this->useCounter;
+    return;
+  }
+
+  stream->lastLine = line;
+  stream->lastUse = ++this->useCounter;
+  int32_t step = stream->direction * int32_t(this->blockSize);
+  // Prefetch up to STREAM_DISTANCE lines ahead of the demand access
+  int64_t ahead = (int64_t(stream->prefetchedLine) - line) *
+                  stream->direction / this->blockSize;
+  if (ahead < 0) { // the demand stream overtook the prefetches
+    stream->prefetchedLine = line;
+    ahead = 0;
+  }
+  for (; ahead < STREAM_DISTANCE; ++ahead) {
+    stream->prefetchedLine += step;
+    prefetches.push_back(stream->prefetchedLine);
+  }
+}
+
+bool StreamPrefetcher::saveState(FILE *file) {
+  return fwrite(this->streams, sizeof(this->streams), 1, file) == 1 &&
+         fwrite(&this->useCounter, 4, 1, file) == 1;
+}
+
+bool StreamPrefetcher::loadState(FILE *file) {
+  return fread(this->streams, sizeof(this->streams), 1, file) == 1 &&
+         fread(&this->useCounter, 4, 1, file) == 1;
+}
@@ -0,0 +1,125 @@
+/*
+ * Hardware prefetchers for the cache
+ *
+ *   NextLine  on a miss, or on the first use of a prefetched line, fetches
+ *             the next line
+ *   Stride    reference prediction table indexed by the PC of the access,
+ *             once the same stride is seen twice in a row it fetches the
+ *             next STRIDE_DEGREE strides ahead, needs the PC
+ *   Stream    stream buffer style detector, it follows up to STREAM_NUM
+ *             ascending or descending miss streams and keeps each one
+ *             STREAM_DISTANCE lines ahead of its demand accesses
+ *
+ * A prefetcher only observes the demand accesses of its cache level and
+ * proposes lines. The cache drops lines it already holds and fills the
+ * others like a miss, so prefetches compete for space with demand lines.
+ */
+
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class Prefetcher {
+public:
+  enum Kind {
+    NONE = 0,
+    NEXT_LINE,
+    STRIDE,
+    STREAM,
+    KIND_NUM,
+  };
+
+  enum Outcome {
+    HIT,
+    MISS,
+    PREFETCH_HIT, // first demand access to a prefetched line
+  };
+
+  // Returns nullptr for NONE
+  static Prefetcher *create(Kind kind, uint32_t blockSize);
+  // Accepts the names returned by getKindName, case insensitive
+  static bool parseKind(const char *name, Kind *kind);
+  static const char *getKindName(Kind kind);
+
+  virtual ~Prefetcher() {}
+
+  // Observes a demand access, pc is 0 when unknown, and appends the
+  // addresses of the lines to prefetch
+  virtual void observe(uint32_t addr, uint32_t pc, Outcome outcome,
+                       std::vector<uint32_t> &prefetches) = 0;
+
+  // Training state, for checkpoints
+  virtual bool saveState(FILE *file) { return true; }
+  virtual bool loadState(FILE *file) { return true; }
+
+protected:
+  Prefetcher(uint32_t blockSize);
+
+  uint32_t blockSize;
+  uint32_t getLine(uint32_t addr) { return addr & ~(this->blockSize - 1); }
+};
+
+class NextLinePrefetcher : public Prefetcher {
+public:
+  NextLinePrefetcher(uint32_t blockSize);
+
+  void observe(uint32_t addr, uint32_t pc, Outcome outcome,
+               std::vector<uint32_t> &prefetches) override;
+};
+
+class StridePrefetcher : public Prefetcher {
+public:
+  StridePrefetcher(uint32_t blockSize);
+
+  void observe(uint32_t addr, uint32_t pc, Outcome outcome,
+               std::vector<uint32_t> &prefetches) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+private:
+  static const uint32_t TABLE_SIZE = 256;
+  static const uint32_t STRIDE_DEGREE = 2;
+  static const uint8_t CONFIDENCE_MAX = 3;
+  static const uint8_t CONFIDENCE_THRESHOLD = 2;
+
+  struct Entry {
+    uint32_t pc;
+    uint32_t lastAddr;
+    int32_t stride;
+    uint8_t confidence;
+  };
+
+  Entry table[TABLE_SIZE];
+};
+
+class StreamPrefetcher : public Prefetcher {
+public:
+  StreamPrefetcher(uint32_t blockSize);
+
+  void observe(uint32_t addr, uint32_t pc, Outcome outcome,
+               std::vector<uint32_t> &prefetches) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+private:
+  static const uint32_t STREAM_NUM = 8;
+  static const uint32_t STREAM_DISTANCE = 4; // in lines
+  // A miss this many lines from a stream's last access continues it
+  static const uint32_t STREAM_WINDOW = 2;
+
+  struct Stream {
+    bool valid;
+    int32_t direction; // 0 while only one miss has been seen
+    uint32_t lastLine;
+    uint32_t prefetchedLine; // furthest line prefetched
+    uint32_t lastUse;        // for LRU allocation
+  };
+
+  Stream streams[STREAM_NUM];
+  uint32_t useCounter;
+};
+
+#endif
@@ -0,0 +1,536 @@
+/*
+ * Implementation of the cache replacement policies
+ */
+
+#include <strings.h>
+#include <unordered_map>
+
+#include "ReplacementPolicy.h"
+
+namespace {
+
+const char *KINDNAME[] = {
+    "LRU",   "TreePLRU", "BitPLRU", "FIFO", "Random",
+    "SRRIP", "BRRIP",    "DRRIP",   "DIP",  "OPT",
+};
+
+template <typename T> bool saveVector(FILE *file, const std::vector<T> &vec) {
+  return fwrite(vec.data(), sizeof(T), vec.size(), file) == vec.size();
+}
+
+template <typename T> bool loadVector(FILE *file, std::vector<T> &vec) {
+  return fread(vec.data(), sizeof(T), vec.size(), file) == vec.size();
+}
+
+} // namespace
+
+ReplacementPolicy *ReplacementPolicy::create(Kind kind, uint32_t setNum,
+                                             uint32_t associativity) {
+  switch (kind) {
+  case LRU:
+    return new LRUPolicy(setNum, associativity);
+  case TREE_PLRU:
+    return new TreePLRUPolicy(setNum, associativity);
+  case BIT_PLRU:
+    return new BitPLRUPolicy(setNum, associativity);
+  case FIFO:
+    return new FIFOPolicy(setNum, associativity);
+  case RANDOM:
+    return new RandomPolicy(setNum, associativity);
+  case SRRIP:
+  case BRRIP:
+  case DRRIP:
+    return new RRIPPolicy(kind, setNum, associativity);
+  case DIP:
+    return new DIPPolicy(setNum, associativity);
+  case OPT:
+    return new OPTPolicy(setNum, associativity);
+  default:
+    return nullptr;
+  }
+}
+
+bool ReplacementPolicy::parseKind(const char *name, Kind *kind) {
+  for (int i = 0; i < KIND_NUM; ++i) {
+    if (strcasecmp(name, KINDNAME[i]) == 0) {
+      *kind = Kind(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *ReplacementPolicy::getKindName(Kind kind) {
+  if (kind < 0 || kind >= KIND_NUM) {
+    return "Unknown";
+  }
+  return KINDNAME[kind];
+}
+
+bool ReplacementPolicy::isAssociativitySupported(Kind kind,
+                                                 uint32_t associativity) {
+  if (kind == TREE_PLRU) {
+    return associativity > 0 && (associativity & (associativity - 1)) == 0;
+  }
+  if (kind == DIP) {
+    return associativity > 0 && associativity <= 256;
+  }
+  return associativity > 0;
+}
+
+ReplacementPolicy::ReplacementPolicy(Kind kind, uint32_t setNum,
+                                     uint32_t associativity) {
+  this->kind = kind;
+  this->setNum = setNum;
+  this->associativity = associativity;
+}
+
+LRUPolicy::LRUPolicy(uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(LRU, setNum, associativity) {
+  this->referenceCounter = 0;
+  this->lastReference = std::vector<uint32_t>(setNum * associativity, 0);
+}
+
+void LRUPolicy::touch(uint32_t set, uint32_t way) {
+  this->lastReference[set * this->associativity + way] =
+      ++this->referenceCounter;
+}
+
+void LRUPolicy::insert(uint32_t set, uint32_t way) { this->touch(set, way); }
+
+uint32_t LRUPolicy::getVictim(uint32_t set) {
+  const uint32_t *ref = &this->lastReference[set * this->associativity];
+  uint32_t victim = 0;
+  for (uint32_t i = 1; i < this->associativity; ++i) {
+    if (ref[i] < ref[victim]) {
+      victim = i;
+    }
+  }
+  return victim;
+}
+
+uint32_t LRUPolicy::getLineState(uint32_t set, uint32_t way) {
+  return this->lastReference[set * this->associativity + way];
+}
+
+bool LRUPolicy::saveState(FILE *file) {
+  return fwrite(&this->referenceCounter, 4, 1, file) == 1 &&
+         saveVector(file, this->lastReference);
+}
+
+bool LRUPolicy::loadState(FILE *file) {
+  return fread(&this->referenceCounter, 4, 1, file) == 1 &&
+         loadVector(file, this->lastReference);
+}
+
+TreePLRUPolicy::TreePLRUPolicy(uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(TREE_PLRU, setNum, associativity) {
+  this->levels = 0;
+  while ((1u << this->levels) < associativity) {
+    this->levels++;
+  }
+  this->nodes = std::vector<uint8_t>(setNum * associativity, 0);
+}
+
+void TreePLRUPolicy::touch(uint32_t set, uint32_t way) {
+  uint8_t *tree = &this->nodes[set * this->associativity];
+  uint32_t node = 1;
+  for (uint32_t level = this->levels; level > 0; --level) {
+    uint32_t right = (way >> (level - 1)) & 1;
+    tree[node] = !right;
+    node = 2 * node + right;
+  }
+}
+
+void TreePLRUPolicy::insert(uint32_t set, uint32_t way) {
+  this->touch(set, way);
+}
+
+uint32_t TreePLRUPolicy::getVictim(uint32_t set) {
+  const uint8_t *tree = &this->nodes[set * this->associativity];
+  uint32_t node = 1;
+  while (node < this->associativity) {
+    node = 2 * node + tree[node];
+  }
+  return node - this->associativity;
+}
+
+uint32_t TreePLRUPolicy::getLineState(uint32_t set, uint32_t way) {
+  // 1 for the way the tree currently points to
+  return this->getVictim(set) == way;
+}
+
+bool TreePLRUPolicy::saveState(FILE *file) {
+  return saveVector(file, this->nodes);
+}
+
+bool TreePLRUPolicy::loadState(FILE *file) {
+  return loadVector(file, this->nodes);
+}
+
+BitPLRUPolicy::BitPLRUPolicy(uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(BIT_PLRU, setNum, associativity) {
+  this->mru = std::vector<uint8_t>(setNum * associativity, 0);
+}
+
+void BitPLRUPolicy::touch(uint32_t set, uint32_t way) {
+  uint8_t *bits = &this->mru[set * this->associativity];
+  bits[way] = 1;
+  for (uint32_t i = 0; i < this->associativity; ++i) {
+    if (!bits[i]) {
+      return;
+    }
+  }
+  for (uint32_t i = 0; i < this->associativity; ++i) {
+    bits[i] = i == way;
+  }
+}
+
+void BitPLRUPolicy::insert(uint32_t set, uint32_t way) {
+  this->touch(set, way);
+}
+
+uint32_t BitPLRUPolicy::getVictim(uint32_t set) {
+  const uint8_t *bits = &this->mru[set * this->associativity];
+  for (uint32_t i = 0; i < this->associativity; ++i) {
+    if (!bits[i]) {
+      return i;
+    }
+  }
+  return 0; // only with a single way
+}
+
+uint32_t BitPLRUPolicy::getLineState(uint32_t set, uint32_t way) {
+  return this->mru[set * this->associativity + way];
+}
+
+bool BitPLRUPolicy::saveState(FILE *file) {
+  return saveVector(file, this->mru);
+}
+
+bool BitPLRUPolicy::loadState(FILE *file) {
+  return loadVector(file, this->mru);
+}
+
+FIFOPolicy::FIFOPolicy(uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(FIFO, setNum, associativity) {
+  this->fillCounter = 0;
+  this->fillTime = std::vector<uint32_t>(setNum * associativity, 0);
+}
+
+void FIFOPolicy::touch(uint32_t set, uint32_t way) {}
+
+void FIFOPolicy::insert(uint32_t set, uint32_t way) {
+  this->fillTime[set * this->associativity + way] = ++this->fillCounter;
+}
+
+uint32_t FIFOPolicy::getVictim(uint32_t set) {
+  const uint32_t *time = &this->fillTime[set * this->associativity];
+  uint32_t victim = 0;
+  for (uint32_t i = 1; i < this->associativity; ++i) {
+    if (time[i] < time[victim]) {
+      victim = i;
+    }
+  }
+  return victim;
+}
+
+uint32_t FIFOPolicy::getLineState(uint32_t set, uint32_t way) {
+  return this->fillTime[set * this->associativity + way];
+}
+
+bool FIFOPolicy::saveState(FILE *file) {
+  return fwrite(&this->fillCounter, 4, 1, file) == 1 &&
+         saveVector(file, this->fillTime);
+}
+
+bool FIFOPolicy::loadState(FILE *file) {
+  return fread(&this->fillCounter, 4, 1, file) == 1 &&
+         loadVector(file, this->fillTime);
+}
+
+RandomPolicy::RandomPolicy(uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(RANDOM, setNum, associativity) {
+  this->seed = 2463534242u;
+}
+
+void RandomPolicy::touch(uint32_t set, uint32_t way) {}
+
+void RandomPolicy::insert(uint32_t set, uint32_t way) {}
+
+uint32_t RandomPolicy::getVictim(uint32_t set) {
+  this->seed ^= this->seed << 13;
+  this->seed ^= this->seed >> 17;
+  this->seed ^= this->seed << 5;
+  return this->seed % this->associativity;
+}
+
+uint32_t RandomPolicy::getLineState(uint32_t set, uint32_t way) { return 0; }
+
+bool RandomPolicy::saveState(FILE *file) {
+  return fwrite(&this->seed, 4, 1, file) == 1;
+}
+
+bool RandomPolicy::loadState(FILE *file) {
+  return fread(&this->seed, 4, 1, file) == 1 && this->seed != 0;
+}
+
+SetDuel::SetDuel(uint32_t setNum) {
+  // About one set in 32 leads for each policy
+  uint32_t leaders = setNum / 32 < LEADER_SETS ? setNum / 32 : LEADER_SETS;
+  this->regionSize = leaders > 0 ? setNum / leaders : setNum;
+  this->psel = PSEL_MAX / 2; // followers start with the first policy
+  this->resetStatistics();
+}
+
+void SetDuel::recordMiss(uint32_t set) {
+  uint32_t offset = set % this->regionSize;
+  if (offset == 0) {
+    if (this->psel < PSEL_MAX) {
+      this->psel++;
+    }
+  } else if (offset == this->regionSize - 1) {
+    if (this->psel > 0) {
+      this->psel--;
+    }
+  }
+}
+
+void SetDuel::printStatistics(const char *first, const char *second) {
+  uint64_t total = this->winCount[0] + this->winCount[1];
+  double share = total != 0 ? (double)this->winCount[0] / total : 0.0;
+  printf("Set Dueling: %s %.2f%% %s %.2f%% of accesses, PSEL %u\n", first,
+         100.0 * share, second, total != 0 ? 100.0 * (1 - share) : 0.0,
+         this->psel);
+}
+
+void SetDuel::resetStatistics() {
+  this->winCount[0] = 0;
+  this->winCount[1] = 0;
+}
+
+bool SetDuel::saveState(FILE *file) {
+  return fwrite(&this->psel, 4, 1, file) == 1;
+}
+
+bool SetDuel::loadState(FILE *file) {
+  return fread(&this->psel, 4, 1, file) == 1 && this->psel <= PSEL_MAX;
+}
+
+RRIPPolicy::RRIPPolicy(Kind kind, uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(kind, setNum, associativity), duel(setNum) {
+  this->bimodalCounter = 0;
+  this->rrpv = std::vector<uint8_t>(setNum * associativity, RRPV_MAX);
+}
+
+void RRIPPolicy::touch(uint32_t set, uint32_t way) {
+  this->rrpv[set * this->associativity + way] = 0;
+  if (this->kind == DRRIP) {
+    this->duel.recordAccess();
+  }
+}
+
+void RRIPPolicy::insert(uint32_t set, uint32_t way) {
+  bool bimodal = this->kind == BRRIP;
+  if (this->kind == DRRIP) {
+    this->duel.recordMiss(set);
+    this->duel.recordAccess();
+    bimodal = this->duel.useSecond(set);
+  }
+  uint32_t line = set * this->associativity + way;
+  if (!bimodal) {
+    this->rrpv[line] = RRPV_MAX - 1;
+  } else if (++this->bimodalCounter == BIMODAL_PERIOD) {
+    this->bimodalCounter = 0;
+    this->rrpv[line] = RRPV_MAX - 1;
+  } else {
+    this->rrpv[line] = RRPV_MAX;
+  }
+}
+
+uint32_t RRIPPolicy::getVictim(uint32_t set) {
+  // Age the whole set until some line is predicted to be re-referenced in
+  // the distant future
+  uint8_t *values = &this->rrpv[set * this->associativity];
+  uint8_t oldest = 0;
+  for (uint32_t i = 0; i < this->associativity; ++i) {
+    if (values[i] > oldest) {
+      oldest = values[i];
+    }
+  }
+  uint8_t age = RRPV_MAX - oldest;
+  uint32_t victim = this->associativity;
+  for (uint32_t i = 0; i < this->associativity; ++i) {
+    values[i] += age;
+    if (values[i] == RRPV_MAX && victim == this->associativity) {
+      victim = i;
+    }
+  }
+  return victim;
+}
+
+uint32_t RRIPPolicy::getLineState(uint32_t set, uint32_t way) {
+  return this->rrpv[set * this->associativity + way];
+}
+
+bool RRIPPolicy::saveState(FILE *file) {
+  return fwrite(&this->bimodalCounter, 4, 1, file) == 1 &&
+         saveVector(file, this->rrpv) && this->duel.saveState(file);
+}
+
+bool RRIPPolicy::loadState(FILE *file) {
+  return fread(&this->bimodalCounter, 4, 1, file) == 1 &&
+         loadVector(file, this->rrpv) && this->duel.loadState(file);
+}
+
+void RRIPPolicy::printStatistics() {
+  if (this->kind == DRRIP) {
+    this->duel.printStatistics("SRRIP", "BRRIP");
+  }
+}
+
+void RRIPPolicy::resetStatistics() { this->duel.resetStatistics(); }
+
+DIPPolicy::DIPPolicy(uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(DIP, setNum, associativity), duel(setNum) {
+  this->bimodalCounter = 0;
+  this->position = std::vector<uint8_t>(setNum * associativity);
+  for (uint32_t i = 0; i < this->position.size(); ++i) {
+    this->position[i] = i % associativity;
+  }
+}
+
+void DIPPolicy::touch(uint32_t set, uint32_t way) {
+  this->moveTo(set, way, 0);
+  this->duel.recordAccess();
+}
+
+void DIPPolicy::insert(uint32_t set, uint32_t way) {
+  this->duel.recordMiss(set);
+  this->duel.recordAccess();
+  // LRU inserts at the MRU position, BIP only once every BIMODAL_PERIOD
+  // fills and at the LRU position otherwise
+  bool mru = true;
+  if (this->duel.useSecond(set)) {
+    mru = ++this->bimodalCounter == BIMODAL_PERIOD;
+    if (mru) {
+      this->bimodalCounter = 0;
+    }
+  }
+  this->moveTo(set, way, mru ? 0 : this->associativity - 1);
+}
+
+uint32_t DIPPolicy::getVictim(uint32_t set) {
+  const uint8_t *pos = &this->position[set * this->associativity];
+  for (uint32_t i = 0; i < this->associativity; ++i) {
+    if (pos[i] == this->associativity - 1) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+// Moves a line to a position of the recency stack, shifting the lines in
+// between by one
+void DIPPolicy::moveTo(uint32_t set, uint32_t way, uint32_t target) {
+  uint8_t *pos = &this->position[set * this->associativity];
+  uint32_t current = pos[way];
+  for (uint32_t i = 0; i < this->associativity; ++i) {
+    if (target < current && pos[i] >= target && pos[i] < current) {
+      pos[i]++;
+    } else if (target > current && pos[i] > current && pos[i] <= target) {
+      pos[i]--;
+    }
+  }
+  pos[way] = target;
+}
+
+uint32_t DIPPolicy::getLineState(uint32_t set, uint32_t way) {
+  return this->position[set * this->associativity + way];
+}
+
+bool DIPPolicy::saveState(FILE *file) {
+  return fwrite(&this->bimodalCounter, 4, 1, file) == 1 &&
+         saveVector(file, this->position) && this->duel.saveState(file);
+}
+
+bool DIPPolicy::loadState(FILE *file) {
+  return fread(&this->bimodalCounter, 4, 1, file) == 1 &&
+         loadVector(file, this->position) && this->duel.loadState(file);
+}
+
+void DIPPolicy::printStatistics() {
+  this->duel.printStatistics("LRU", "BIP");
+}
+
+void DIPPolicy::resetStatistics() { this->duel.resetStatistics(); }
+
+std::vector<uint32_t>
+OPTPolicy::computeNextUse(const std::vector<uint32_t> &lines) {
+  std::vector<uint32_t> nextUse(lines.size());
+  std::unordered_map<uint32_t, uint32_t> seen;
+  for (size_t i = lines.size(); i-- > 0;) {
+    auto it = seen.find(lines[i]);
+    if (it == seen.end()) {
+      nextUse[i] = NEVER;
+      seen[lines[i]] = i;
+    } else {
+      nextUse[i] = it->second;
+      it->second = i;
+    }
+  }
+  return nextUse;
+}
+
+OPTPolicy::OPTPolicy(uint32_t setNum, uint32_t associativity)
+    : ReplacementPolicy(OPT, setNum, associativity) {
+  this->nextUse = nullptr;
+  this->accessNum = 0;
+  this->lineNextUse = std::vector<uint32_t>(setNum * associativity, NEVER);
+}
+
+void OPTPolicy::setNextUse(const std::vector<uint32_t> *nextUse) {
+  this->nextUse = nextUse;
+  this->accessNum = 0;
+}
+
+void OPTPolicy::touch(uint32_t set, uint32_t way) {
+  this->lineNextUse[set * this->associativity + way] =
+      this->getCurrentNextUse();
+}
+
+void OPTPolicy::insert(uint32_t set, uint32_t way) { this->touch(set, way); }
+
+uint32_t OPTPolicy::getVictim(uint32_t set) {
+  const uint32_t *next = &this->lineNextUse[set * this->associativity];
+  uint32_t victim = 0;
+  for (uint32_t i = 1; i < this->associativity; ++i) {
+    if (next[i] > next[victim]) {
+      victim = i;
+    }
+  }
+  return victim;
+}
+
+uint32_t OPTPolicy::getLineState(uint32_t set, uint32_t way) {
+  return this->lineNextUse[set * this->associativity + way];
+}
+
+bool OPTPolicy::saveState(FILE *file) {
+  return fwrite(&this->accessNum, 4, 1, file) == 1 &&
+         saveVector(file, this->lineNextUse);
+}
+
+bool OPTPolicy::loadState(FILE *file) {
+  return fread(&this->accessNum, 4, 1, file) == 1 &&
+         loadVector(file, this->lineNextUse);
+}
+
+// Without a sequence, or past its end, every line looks dead
+uint32_t OPTPolicy::getCurrentNextUse() {
+  if (this->nextUse == nullptr || this->accessNum == 0 ||
+      this->accessNum > this->nextUse->size()) {
+    return NEVER;
+  }
+  return (*this->nextUse)[this->accessNum - 1];
+}
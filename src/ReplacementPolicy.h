@@ -0,0 +1,291 @@
+/*
+ * Cache replacement policies
+ *
+ *   LRU         true least recently used, one timestamp per line
+ *   Tree-PLRU   binary tree of ways - 1 bits per set, pointing away from
+ *               the most recent access, power of two associativity only
+ *   Bit-PLRU    one MRU bit per line, cleared in the whole set once every
+ *               line has it set
+ *   FIFO        evicts the line filled first
+ *   Random      evicts a pseudo-random way
+ *   SRRIP       2-bit re-reference prediction values, lines are inserted
+ *               with a long re-reference interval and promoted on a hit
+ *   BRRIP       like SRRIP, but inserts with a distant re-reference interval
+ *               except for one fill in 32, so scans do not flush the set
+ *   DRRIP       set dueling between SRRIP and BRRIP
+ *   DIP         set dueling between LRU and BIP, which inserts at the LRU
+ *               position except for one fill in 32
+ *
+ *   OPT         Belady's optimal policy, evicts the line whose next use is
+ *               furthest in the future, offline trace simulation only
+ *
+ * The adaptive policies dedicate a few leader sets to each of the two
+ * competing policies. A saturating PSEL counter goes up on a miss in a
+ * leader set of the first policy and down on a miss in one of the second,
+ * and the other sets follow whichever policy misses less.
+ *
+ * The cache fills invalid lines first and only asks the policy for a victim
+ * when the set is full. Every policy is deterministic, so runs are
+ * repeatable.
+ */
+
+#ifndef REPLACEMENT_POLICY_H
+#define REPLACEMENT_POLICY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+class ReplacementPolicy {
+public:
+  enum Kind {
+    LRU = 0,
+    TREE_PLRU,
+    BIT_PLRU,
+    FIFO,
+    RANDOM,
+    SRRIP,
+    BRRIP,
+    DRRIP,
+    DIP,
+    OPT,
+    KIND_NUM,
+  };
+
+  static ReplacementPolicy *create(Kind kind, uint32_t setNum,
+                                   uint32_t associativity);
+  // Accepts the names returned by getKindName, case insensitive
+  static bool parseKind(const char *name, Kind *kind);
+  static const char *getKindName(Kind kind);
+  static bool isAssociativitySupported(Kind kind, uint32_t associativity);
+
+  virtual ~ReplacementPolicy() {}
+
+  // A hit on a line
+  virtual void touch(uint32_t set, uint32_t way) = 0;
+  // A new line filled into the way
+  virtual void insert(uint32_t set, uint32_t way) = 0;
+  // The way to evict from a full set
+  virtual uint32_t getVictim(uint32_t set) = 0;
+  // The policy's view of a line, shown by Cache::printInfo
+  virtual uint32_t getLineState(uint32_t set, uint32_t way) = 0;
+
+  // Policy state, for checkpoints
+  virtual bool saveState(FILE *file) = 0;
+  virtual bool loadState(FILE *file) = 0;
+
+  // Only the adaptive policies keep statistics, printed as one line
+  virtual void printStatistics() {}
+  virtual void resetStatistics() {}
+
+  Kind getKind() { return this->kind; }
+
+protected:
+  ReplacementPolicy(Kind kind, uint32_t setNum, uint32_t associativity);
+
+  Kind kind;
+  uint32_t setNum;
+  uint32_t associativity;
+};
+
+class LRUPolicy : public ReplacementPolicy {
+public:
+  LRUPolicy(uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+private:
+  uint32_t referenceCounter;
+  std::vector<uint32_t> lastReference;
+};
+
+class TreePLRUPolicy : public ReplacementPolicy {
+public:
+  TreePLRUPolicy(uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+private:
+  uint32_t levels;
+  // associativity entries per set, node 1 is the root and the children of
+  // node n are 2n and 2n + 1, a node set to 1 points to its right subtree
+  std::vector<uint8_t> nodes;
+};
+
+class BitPLRUPolicy : public ReplacementPolicy {
+public:
+  BitPLRUPolicy(uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+private:
+  std::vector<uint8_t> mru;
+};
+
+class FIFOPolicy : public ReplacementPolicy {
+public:
+  FIFOPolicy(uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+private:
+  uint32_t fillCounter;
+  std::vector<uint32_t> fillTime;
+};
+
+class RandomPolicy : public ReplacementPolicy {
+public:
+  RandomPolicy(uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+private:
+  uint32_t seed; // xorshift32 state, never 0
+};
+
+// Leader set selection and the PSEL counter of the adaptive policies
+class SetDuel {
+public:
+  SetDuel(uint32_t setNum);
+
+  // Whether the set uses the second policy
+  bool useSecond(uint32_t set) {
+    uint32_t offset = set % this->regionSize;
+    if (offset == 0) {
+      return false;
+    }
+    if (offset == this->regionSize - 1) {
+      return true;
+    }
+    return this->psel > PSEL_MAX / 2;
+  }
+  void recordMiss(uint32_t set);
+  // Counts an access towards the policy followers currently use
+  void recordAccess() { this->winCount[this->psel > PSEL_MAX / 2]++; }
+
+  void printStatistics(const char *first, const char *second);
+  void resetStatistics();
+  bool saveState(FILE *file);
+  bool loadState(FILE *file);
+
+private:
+  static const uint32_t LEADER_SETS = 32; // per policy, at most
+  static const uint32_t PSEL_MAX = 1023;  // 10 bits
+
+  // One leader set of each policy in every region, the first and the last
+  // set of the region. A cache with a single set runs the first policy.
+  uint32_t regionSize;
+  uint32_t psel;
+  uint64_t winCount[2];
+};
+
+// SRRIP, BRRIP and DRRIP, they differ only in the insertion position
+class RRIPPolicy : public ReplacementPolicy {
+public:
+  RRIPPolicy(Kind kind, uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+  void printStatistics() override;
+  void resetStatistics() override;
+
+private:
+  static const uint8_t RRPV_MAX = 3;
+  // BRRIP inserts one fill in BIMODAL_PERIOD with a long interval
+  static const uint32_t BIMODAL_PERIOD = 32;
+
+  uint32_t bimodalCounter;
+  std::vector<uint8_t> rrpv;
+  SetDuel duel; // DRRIP only
+};
+
+// DIP keeps an exact recency stack, as LIP and BIP insert below the lines
+// already in the set
+class DIPPolicy : public ReplacementPolicy {
+public:
+  DIPPolicy(uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+  void printStatistics() override;
+  void resetStatistics() override;
+
+private:
+  static const uint32_t BIMODAL_PERIOD = 32;
+
+  uint32_t bimodalCounter;
+  // Position of each line in its set's recency stack, 0 for the MRU line
+  std::vector<uint8_t> position;
+  SetDuel duel;
+
+  void moveTo(uint32_t set, uint32_t way, uint32_t target);
+};
+
+// OPT needs to know the future, so it is handed the next use of every line
+// access the cache will make, and the cache moves it on by one access at a
+// time. Only the victim choice is optimal, every miss still fills a line.
+class OPTPolicy : public ReplacementPolicy {
+public:
+  static const uint32_t NEVER = UINT32_MAX;
+
+  // For each access of a sequence of line addresses, the index of the next
+  // access to the same line, or NEVER
+  static std::vector<uint32_t>
+  computeNextUse(const std::vector<uint32_t> &lines);
+
+  OPTPolicy(uint32_t setNum, uint32_t associativity);
+
+  void touch(uint32_t set, uint32_t way) override;
+  void insert(uint32_t set, uint32_t way) override;
+  uint32_t getVictim(uint32_t set) override;
+  uint32_t getLineState(uint32_t set, uint32_t way) override;
+  bool saveState(FILE *file) override;
+  bool loadState(FILE *file) override;
+
+  // The sequence is not copied and must outlive the policy
+  void setNextUse(const std::vector<uint32_t> *nextUse);
+  // Called at the start of every line access of the cache
+  void advance() { this->accessNum++; }
+
+private:
+  const std::vector<uint32_t> *nextUse;
+  uint32_t accessNum;
+  std::vector<uint32_t> lineNextUse;
+
+  uint32_t getCurrentNextUse();
+};
+
+#endif
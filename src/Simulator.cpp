@@ -2,6 +2,7 @@
  * Created by He, Hao at 2019-3-11
  */
 
+#include <cinttypes>
 #include <cstring>
 #include <fstream>
 #include <sstream>
@@ -60,16 +61,44 @@ const char *INSTNAME[]{
 
 using namespace RISCV;
 
+const char *Simulator::CPINAME[Simulator::CPI_NUM] = {
+    "Base",       "Data Hazard", "Load-Use",   "Branch Mispredict",
+    "Branch Redirect", "Jump",   "I-Cache",    "D-Cache L1",
+    "D-Cache L2", "D-Cache L3",  "D-Cache Memory", "Execute",
+};
+
 Simulator::Simulator(MemoryManager *memory, BranchPredictor *predictor) {
   this->memory = memory;
   this->branchPredictor = predictor;
+  this->bbvProfiler = nullptr;
+  this->pcProfiler = nullptr;
+  this->pipeTracer = nullptr;
+  this->fastForwardInst = 0;
+  this->hasFastForwardMarker = false;
+  this->fastForwardMarker = 0;
+  this->maxDetailedInst = 0;
+  this->functional = false;
+  this->fastForwarded = 0;
   this->pc = 0;
   for (int i = 0; i < REGNUM; ++i) {
     this->reg[i] = 0;
   }
+  for (int i = 0; i < 1024; ++i) {
+    this->decodeTable[i] = nullptr;
+  }
 }
 
-Simulator::~Simulator() {}
+Simulator::~Simulator() {
+  for (int i = 0; i < 1024; ++i) {
+    if (this->decodeTable[i] == nullptr) {
+      continue;
+    }
+    for (int j = 0; j < 1024; ++j) {
+      delete[] this->decodeTable[i][j];
+    }
+    delete[] this->decodeTable[i];
+  }
+}
 
 void Simulator::initStack(uint32_t baseaddr, uint32_t maxSize) {
   this->reg[REG_SP] = baseaddr;
@@ -78,6 +107,12 @@ void Simulator::initStack(uint32_t baseaddr, uint32_t maxSize) {
 }
 
 void Simulator::simulate() {
+  this->resetHistory();
+  if (this->fastForwardInst > 0 || this->hasFastForwardMarker) {
+    this->fastForward(true);
+  }
+  this->functional = false;
+
   // Initialize pipeline registers
   memset(&this->fReg, 0, sizeof(this->fReg));
   memset(&this->fRegNew, 0, sizeof(this->fRegNew));
@@ -87,6 +122,8 @@ void Simulator::simulate() {
   memset(&this->eRegNew, 0, sizeof(this->eRegNew));
   memset(&this->mReg, 0, sizeof(this->mReg));
   memset(&this->mRegNew, 0, sizeof(this->mRegNew));
+  memset(this->pendingLoad, 0, sizeof(this->pendingLoad));
+  this->bypassHint = 0;
 
   // Insert Bubble to later pipeline stages
   fReg.bubble = true;
@@ -96,6 +133,7 @@ void Simulator::simulate() {
 
   this->rstPcCnt = -1;
   this->forwardFetcher = false;
+  this->stallCause = CPI_DATA_HAZARD;
   // Main Simulation Loop
   while (true) {
     if (this->rstPcCnt == 0) {
@@ -127,17 +165,30 @@ void Simulator::simulate() {
     // THE EXECUTION ORDER of these functions are important!!!
     // Changing them will introduce strange bugs
 
+    if (this->pipeTracer != nullptr) {
+      this->tracePipeline();
+    }
+
     uint32_t pcIn = this->pc;
 
     this->fetch();
     if (this->forwardFetcher && this->rstPcCnt == 1) {
       this->fReg.bubble = true;
+      this->fReg.cause = this->stallCause;
       this->forwardFetcher = false;
     }
     this->decode();
     this->excecute();
     this->memoryAccess();
     this->writeBack();
+    // After the memory stage, so the access of an older load in it is not
+    // held back by a younger instruction waiting for data
+    if (!this->dReg.bubble && !this->dReg.stall) {
+      this->waitForPendingLoads();
+    }
+    if (this->pipeTracer != nullptr) {
+      this->traceForwarding();
+    }
 
     if(stallCnt > 0) {
       this->decodeWho = fReg;
@@ -162,6 +213,7 @@ void Simulator::simulate() {
           this->rstPcCnt = 1;
         }
         this->dReg.bubble = true;
+        this->dReg.cause = this->stallCause;
         break;
       case 2:
         if(this->rstPcCnt < 0){
@@ -169,6 +221,8 @@ void Simulator::simulate() {
         }
         this->dReg.bubble = true;
         this->fReg.bubble = true;
+        this->dReg.cause = this->stallCause;
+        this->fReg.cause = this->stallCause;
         break;
       case 3:
         if(this->rstPcCnt < 0){
@@ -176,6 +230,8 @@ void Simulator::simulate() {
         }
         this->dReg.bubble = true;
         this->fReg.bubble = true;
+        this->dReg.cause = this->stallCause;
+        this->fReg.cause = this->stallCause;
         this->forwardFetcher = true;
         break;
       default:
@@ -194,14 +250,16 @@ void Simulator::simulate() {
     }
 
     this->history.cycleCount++;
+    if (this->maxDetailedInst != 0 &&
+        this->history.instCount >= this->maxDetailedInst) {
+      printf("Detailed simulation stopped after %u instructions\n",
+             this->history.instCount);
+      this->printStatistics();
+      return;
+    }
     if(verbose){
       std::cerr << this->history.cycleCount << std::endl;
     }
-    this->history.regRecord.push_back(this->getRegInfoStr());
-    if (this->history.regRecord.size() >= 100000) { // Avoid using up memory
-      this->history.regRecord.clear();
-      this->history.instRecord.clear();
-    }
 
     if (verbose) {
       std::cerr << "STALL COUNT: " << this->stallCnt << std::endl;
@@ -210,24 +268,481 @@ void Simulator::simulate() {
     }
 
     if (this->isSingleStep) {
-      printf("Type d to dump memory in dump.txt, press ENTER to continue: ");
-      char ch;
-      while ((ch = getchar()) != '\n') {
-        if (ch == 'd') {
-          this->dumpHistory();
-        }
+      this->waitForSingleStep();
+    }
+  }
+}
+
+void Simulator::simulateFunctional() {
+  this->functional = true;
+  this->resetHistory();
+  this->executeFunctional(UINT64_MAX, false, false);
+}
+
+void Simulator::fastForward(bool warmUp) {
+  this->functional = true;
+  this->resetHistory();
+  uint32_t startCount = this->history.instCount;
+  this->executeFunctional(
+      this->fastForwardInst > 0 ? this->fastForwardInst : UINT64_MAX, true,
+      warmUp);
+  this->fastForwarded += this->history.instCount - startCount;
+  printf("Fast-forwarded %" PRIu64 " instructions, stopped at 0x%x\n",
+         this->fastForwarded, this->pc);
+  this->resetStatistics();
+}
+
+// Runs at most instNum instructions, or until the PC reaches
+// fastForwardMarker with stopAtMarker. With warmUp, instruction fetches and
+// data accesses go through the caches and branch outcomes train the
+// predictor as they would in the pipeline.
+void Simulator::executeFunctional(uint64_t instNum, bool stopAtMarker,
+                                  bool warmUp) {
+  for (uint64_t count = 0; count < instNum; ++count) {
+    uint32_t pc = this->pc;
+    if (stopAtMarker && this->hasFastForwardMarker &&
+        pc == this->fastForwardMarker) {
+      return;
+    }
+    if (pc % 2 != 0) {
+      this->panic("Illegal PC 0x%x!\n", pc);
+    }
+    if (this->reg[REG_SP] < this->stackBase - this->maximumStackSize) {
+      this->panic("Stack Overflow!\n");
+    }
+
+    DecodedInst &decoded = this->getDecodedSlot(pc);
+    // Warming fetches every instruction through the caches like the pipeline
+    uint32_t inst = warmUp ? this->memory->fetch(pc) : 0;
+    if (!decoded.valid || decoded.pc != pc) {
+      this->decodeInst(pc, warmUp ? inst : this->memory->getInt(pc), decoded);
+    }
+    if (this->verbose) {
+      printf("0x%x: %s\n", pc, this->disassemble(decoded).c_str());
+    }
+
+    this->history.instCount++;
+
+    int32_t op1 =
+        decoded.rs1 != RegId(-1) ? this->reg[decoded.rs1] : decoded.imm1;
+    int32_t op2 =
+        decoded.rs2 != RegId(-1) ? this->reg[decoded.rs2] : decoded.imm2;
+    int32_t op3 = decoded.rs3 != RegId(-1) ? this->reg[decoded.rs3] : 0;
+    int32_t offset = decoded.offset;
+    uint32_t nextPC = pc + 4;
+    bool writeReg = true;
+    int32_t out = 0;
+    uint32_t memLen = 0;
+
+    switch (decoded.inst) {
+    case LUI:
+      out = offset << 12;
+      break;
+    case AUIPC:
+      out = pc + (offset << 12);
+      break;
+    case JAL:
+      out = pc + 4;
+      nextPC = pc + op1;
+      break;
+    case JALR:
+      out = pc + 4;
+      nextPC = (op1 + op2) & (~(uint32_t)1);
+      break;
+    case BEQ:
+      writeReg = false;
+      if (op1 == op2) {
+        nextPC = pc + offset;
+      }
+      break;
+    case BNE:
+      writeReg = false;
+      if (op1 != op2) {
+        nextPC = pc + offset;
+      }
+      break;
+    case BLT:
+      writeReg = false;
+      if (op1 < op2) {
+        nextPC = pc + offset;
+      }
+      break;
+    case BGE:
+      writeReg = false;
+      if (op1 >= op2) {
+        nextPC = pc + offset;
+      }
+      break;
+    case BLTU:
+      writeReg = false;
+      if ((uint32_t)op1 < (uint32_t)op2) {
+        nextPC = pc + offset;
+      }
+      break;
+    case BGEU:
+      writeReg = false;
+      if ((uint32_t)op1 >= (uint32_t)op2) {
+        nextPC = pc + offset;
+      }
+      break;
+    case LB:
+      out = (int8_t)this->memory->read(op1 + offset, 1);
+      break;
+    case LH:
+      out = (int16_t)this->memory->read(op1 + offset, 2);
+      break;
+    case LW:
+      out = (int32_t)this->memory->read(op1 + offset, 4);
+      break;
+    case LBU:
+      out = this->memory->read(op1 + offset, 1);
+      break;
+    case LHU:
+      out = this->memory->read(op1 + offset, 2);
+      break;
+    case SB:
+      memLen = 1;
+      break;
+    case SH:
+      memLen = 2;
+      break;
+    case SW:
+      memLen = 4;
+      break;
+    case ADDI:
+    case ADD:
+      out = op1 + op2;
+      break;
+    case SUB:
+      out = op1 - op2;
+      break;
+    case MUL:
+      out = op1 * op2;
+      break;
+    case DIV:
+      out = op1 / op2;
+      break;
+    case SLTI:
+    case SLT:
+      out = op1 < op2 ? 1 : 0;
+      break;
+    case SLTIU:
+    case SLTU:
+      out = (uint32_t)op1 < (uint32_t)op2 ? 1 : 0;
+      break;
+    case XORI:
+    case XOR:
+      out = op1 ^ op2;
+      break;
+    case ORI:
+    case OR:
+      out = op1 | op2;
+      break;
+    case ANDI:
+    case AND:
+      out = op1 & op2;
+      break;
+    case SLLI:
+    case SLL:
+      out = op1 << op2;
+      break;
+    case SRLI:
+    case SRL:
+      out = (uint32_t)op1 >> (uint32_t)op2;
+      break;
+    case SRAI:
+    case SRA:
+      out = op1 >> op2;
+      break;
+    case ECALL:
+      out = this->handleSystemCall(op1, op2);
+      break;
+    case FMADD:
+      out = op1 * op2 + op3;
+      break;
+    case FMSUB:
+      out = op1 * op2 - op3;
+      break;
+    case FNMADD:
+      out = -op1 * op2 + op3;
+      break;
+    case FNMSUB:
+      out = -op1 * op2 - op3;
+      break;
+    default:
+      this->panic("Unknown instruction type %d\n", decoded.inst);
+    }
+
+    if (memLen != 0) {
+      writeReg = false;
+      out = op1 + offset;
+      if (!this->memory->write(out, memLen, op2)) {
+        this->panic("Invalid Mem Access!\n");
       }
+      this->invalidateDecodedInst(out, memLen);
+    }
+    if (writeReg && decoded.dest != 0) {
+      this->reg[decoded.dest] = out;
+    }
+    if (warmUp && isBranch(decoded.inst)) {
+      this->branchPredictor->update(pc, nextPC != pc + 4);
+    }
+    if (this->bbvProfiler != nullptr) {
+      this->bbvProfiler->retire(
+          pc, isBranch(decoded.inst) || isJump(decoded.inst));
+    }
+    this->pc = nextPC;
+
+    // Without a pipeline the instruction count stands in for the cycle
+    if (this->shouldDumpHistory) {
+      this->recordHistory(this->history.instCount, pc, decoded.raw,
+                          writeReg ? decoded.dest : 0, out);
+    }
+    if (this->isSingleStep) {
+      this->waitForSingleStep();
+    }
+  }
+}
+
+bool Simulator::saveCheckpoint(const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  Cache *cache = this->memory->getCache();
+  Cache *instCache = this->memory->getInstCache();
+  uint32_t flags = cache != nullptr ? CHECKPOINT_FLAG_WARM : 0;
+  if (cache != nullptr && instCache != nullptr) {
+    flags |= CHECKPOINT_FLAG_ICACHE;
+  }
+  uint32_t cpu[35];
+  cpu[0] = this->pc;
+  memcpy(cpu + 1, this->reg, sizeof(this->reg));
+  cpu[33] = this->stackBase;
+  cpu[34] = this->maximumStackSize;
+  uint64_t instCount = this->fastForwarded;
+
+  bool good = fwrite(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC), 1, file) == 1 &&
+              fwrite(&CHECKPOINT_VERSION, 4, 1, file) == 1 &&
+              fwrite(&flags, 4, 1, file) == 1 &&
+              fwrite(cpu, sizeof(cpu), 1, file) == 1 &&
+              fwrite(&instCount, 8, 1, file) == 1 &&
+              this->memory->saveState(file);
+  if (good && cache != nullptr) {
+    good = this->branchPredictor->saveState(file) && cache->saveState(file);
+  }
+  if (good && (flags & CHECKPOINT_FLAG_ICACHE)) {
+    good = instCache->saveState(file, false);
+  }
+  good = fclose(file) == 0 && good;
+  return good;
+}
+
+bool Simulator::loadCheckpoint(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  char magic[8];
+  uint32_t version, flags;
+  uint32_t cpu[35];
+  uint64_t instCount;
+  bool good = fread(magic, sizeof(magic), 1, file) == 1 &&
+              memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) == 0 &&
+              fread(&version, 4, 1, file) == 1 &&
+              version == CHECKPOINT_VERSION && fread(&flags, 4, 1, file) == 1 &&
+              fread(cpu, sizeof(cpu), 1, file) == 1 &&
+              fread(&instCount, 8, 1, file) == 1 &&
+              this->memory->loadState(file);
+  // Warm state is only restored into a hierarchy that can take it
+  Cache *cache = this->memory->getCache();
+  if (good && (flags & CHECKPOINT_FLAG_WARM) && cache != nullptr) {
+    good = this->branchPredictor->loadState(file) && cache->loadState(file);
+    Cache *instCache = this->memory->getInstCache();
+    if (good && (flags & CHECKPOINT_FLAG_ICACHE) && instCache != nullptr) {
+      good = instCache->loadState(file, false);
+    }
+  }
+  fclose(file);
+  if (!good) {
+    return false;
+  }
+
+  this->pc = cpu[0];
+  memcpy(this->reg, cpu + 1, sizeof(this->reg));
+  this->stackBase = cpu[33];
+  this->maximumStackSize = cpu[34];
+  this->fastForwarded = instCount;
+  return true;
+}
+
+void Simulator::resetHistory() {
+  this->history.records.clear();
+  this->history.nextRecord = 0;
+  this->history.recordCount = 0;
+  if (this->shouldDumpHistory) {
+    this->history.records.resize(HISTORY_SIZE);
+  }
+}
+
+// Starts the measured region, cache contents and predictor tables are kept
+void Simulator::resetStatistics() {
+  this->history.instCount = 0;
+  this->history.cycleCount = 0;
+  this->history.stalledCycleCount = 0;
+  this->history.predictedBranch = 0;
+  this->history.unpredictedBranch = 0;
+  this->history.dataHazardCount = 0;
+  this->history.controlHazardCount = 0;
+  this->history.memoryHazardCount = 0;
+  for (int i = 0; i < CPI_NUM; ++i) {
+    this->history.cpiStack[i] = 0;
+  }
+  this->memory->resetStatistics();
+}
+
+// PC of the oldest instruction still in the pipeline
+uint32_t Simulator::getOldestInstPC() {
+  if (!this->mReg.bubble) {
+    return this->mReg.instPC;
+  }
+  if (!this->eReg.bubble) {
+    return this->eReg.instPC;
+  }
+  if (!this->dReg.bubble) {
+    return this->dReg.pc;
+  }
+  return this->fReg.pc;
+}
+
+// The CPI stack component for the data access just made, by the level of
+// the hierarchy that served it
+Simulator::CPIComponent Simulator::getDataCacheComponent() {
+  Cache *cache = this->memory->getCache();
+  if (cache == nullptr) {
+    return CPI_DCACHE_MEMORY;
+  }
+  uint32_t depth = cache->getLastAccessDepth();
+  if (depth >= cache->getLevelNum()) {
+    return CPI_DCACHE_MEMORY;
+  }
+  if (depth >= 2) {
+    return CPI_DCACHE_L3;
+  }
+  return CPIComponent(CPI_DCACHE_L1 + depth);
+}
+
+// Reports the stage of every instruction in flight at the start of a cycle.
+// Each pipeline register holds the input of a stage, a stalled register
+// keeps its instruction in the stage before.
+void Simulator::tracePipeline() {
+  this->pipeTracer->beginCycle(this->history.cycleCount);
+  if (!this->fReg.bubble && this->fReg.traceId != 0) {
+    this->fReg.traceId = this->traceStage(
+        this->fReg.traceId, this->fReg.pc,
+        this->fReg.stall ? PipeTracer::STAGE_FETCH : PipeTracer::STAGE_DECODE);
+  }
+  if (!this->dReg.bubble && this->dReg.traceId != 0) {
+    this->dReg.traceId = this->traceStage(
+        this->dReg.traceId, this->dReg.pc,
+        this->dReg.stall ? PipeTracer::STAGE_DECODE
+                         : PipeTracer::STAGE_EXECUTE);
+  }
+  if (!this->eReg.bubble && this->eReg.traceId != 0) {
+    this->eReg.traceId = this->traceStage(
+        this->eReg.traceId, this->eReg.instPC, PipeTracer::STAGE_MEMORY);
+  }
+  if (!this->mReg.bubble && this->mReg.traceId != 0) {
+    this->mReg.traceId = this->traceStage(
+        this->mReg.traceId, this->mReg.instPC, PipeTracer::STAGE_WRITEBACK);
+  }
+  this->pipeTracer->endCycle();
+}
+
+// An instruction replayed after a stall without forwarding was already
+// flushed, so it is traced again from fetch
+uint32_t Simulator::traceStage(uint32_t id, uint32_t pc,
+                               PipeTracer::Stage stage) {
+  if (!this->pipeTracer->stage(id, stage)) {
+    id = this->pipeTracer->fetch(pc);
+    this->pipeTracer->stage(id, stage);
+  }
+  return id;
+}
+
+// Draws the values forwarded to decode this cycle
+void Simulator::traceForwarding() {
+  if (!this->dataforwarding) {
+    return;
+  }
+  uint32_t consumer = this->dRegNew.bubble ? 0 : this->dRegNew.traceId;
+  if (this->executeWriteBack && consumer != 0) {
+    this->pipeTracer->forward(consumer, this->dReg.traceId);
+  }
+  if (this->memoryWriteBack) {
+    // A load result goes to the instruction stalled in decode
+    uint32_t target = this->dReg.stall ? this->dReg.traceId : consumer;
+    if (target != 0) {
+      this->pipeTracer->forward(target, this->eReg.traceId);
+    }
+  }
+  RegId dest = this->mReg.destReg;
+  if (!this->mReg.bubble && this->mReg.writeReg && dest != 0 &&
+      consumer != 0 &&
+      (this->dRegNew.rs1 == dest || this->dRegNew.rs2 == dest ||
+       this->dRegNew.rs3 == dest) &&
+      !(this->executeWriteBack && this->executeWBReg == dest) &&
+      !(this->memoryWriteBack && this->memoryWBReg == dest)) {
+    this->pipeTracer->forward(consumer, this->mReg.traceId);
+  }
+}
+
+void Simulator::waitForSingleStep() {
+  printf("Type d to dump memory in dump.txt, press ENTER to continue: ");
+  char ch;
+  while ((ch = getchar()) != '\n') {
+    if (ch == 'd') {
+      this->dumpHistory();
     }
   }
 }
 
+void Simulator::recordHistory(uint32_t cycle, uint32_t pc, uint32_t inst,
+                              RegId destReg, uint32_t value) {
+  HistoryRecord &record = this->history.records[this->history.nextRecord];
+  record.cycle = cycle;
+  record.pc = pc;
+  record.inst = inst;
+  record.destReg = destReg;
+  record.value = value;
+  this->history.nextRecord = (this->history.nextRecord + 1) % HISTORY_SIZE;
+  if (this->history.recordCount < HISTORY_SIZE) {
+    this->history.recordCount++;
+  }
+}
+
 void Simulator::fetch() {
   if (this->pc % 2 != 0) {
     this->panic("Illegal PC 0x%x!\n", this->pc);
   }
 
-  uint32_t inst = this->memory->getInt(this->pc);
+  // Without a split instruction cache fetch latency is not modelled, as in
+  // the original unified model
+  uint32_t cycles = 0;
+  bool timed = this->memory->getInstCache() != nullptr;
+  if (timed) {
+    this->memory->getInstCache()->setAccessInfo(this->pc,
+                                                this->history.cycleCount);
+  }
+  uint32_t inst = this->memory->fetch(this->pc, timed ? &cycles : nullptr);
   uint32_t len = 4;
+  if (cycles != 0) {
+    this->history.cycleCount += cycles;
+    this->history.cpiStack[CPI_ICACHE] += cycles;
+    if (this->pcProfiler != nullptr) {
+      this->pcProfiler->addStallCycles(this->pc, cycles);
+    }
+  }
 
   if (this->verbose) {
     printf("Fetched instruction 0x%.8x at address 0x%x\n", inst, this->pc);
@@ -238,6 +753,10 @@ void Simulator::fetch() {
   this->fRegNew.inst = inst;
   this->fRegNew.len = len;
   this->fRegNew.pc = this->pc;
+  // A fetch during a decode stall is dropped and repeated later
+  if (this->pipeTracer != nullptr && !this->fReg.stall) {
+    this->fRegNew.traceId = this->pipeTracer->fetch(this->pc);
+  }
   this->pc = this->pc + len;
 }
 
@@ -254,425 +773,29 @@ void Simulator::decode() {
       printf("Decode: Bubble\n");
     }
     this->dRegNew.bubble = true;
+    this->dRegNew.cause = this->fReg.cause;
     return;
   }
 
-  std::string instname = "";
-  std::string inststr = "";
-  std::string deststr, op1str, op2str, offsetstr;
-  Inst insttype = Inst::UNKNOWN;
-  uint32_t inst = this->fReg.inst;
-  int32_t op1 = 0, op2 = 0, op3 = 0, offset = 0; // op1, op2 and offset are values
-  RegId dest = 0, reg1 = -1, reg2 = -1, reg3 = -1; // reg1 and reg2 are operands
-
-  // Reg for 32bit instructions
-  if (this->fReg.len == 4) // 32 bit instruction
-  {
-    uint32_t opcode = inst & 0x7F;
-    uint32_t funct3 = (inst >> 12) & 0x7;
-    uint32_t funct2 = (inst >> 25) & 0x3;
-    uint32_t funct7 = (inst >> 25) & 0x7F;
-    RegId rd = (inst >> 7) & 0x1F;
-    RegId rs1 = (inst >> 15) & 0x1F;
-    RegId rs2 = (inst >> 20) & 0x1F;
-    RegId rs3 = (inst >> 27) & 0xF;
-    int32_t imm_i = int32_t(inst) >> 20;
-    int32_t imm_s =
-        int32_t(((inst >> 7) & 0x1F) | ((inst >> 20) & 0xFE0)) << 20 >> 20;
-    int32_t imm_sb = int32_t(((inst >> 7) & 0x1E) | ((inst >> 20) & 0x7E0) |
-                             ((inst << 4) & 0x800) | ((inst >> 19) & 0x1000))
-                         << 19 >>
-                     19;
-    int32_t imm_u = int32_t(inst) >> 12;
-    int32_t imm_uj = int32_t(((inst >> 21) & 0x3FF) | ((inst >> 10) & 0x400) |
-                             ((inst >> 1) & 0x7F800) | ((inst >> 12) & 0x80000))
-                         << 12 >>
-                     11;
-
-    switch (opcode) {
-    case OP_REG:
-      op1 = this->reg[rs1];
-      op2 = this->reg[rs2];
-      reg1 = rs1;
-      reg2 = rs2;
-      dest = rd;
-      switch (funct3) {
-      case 0x0: // add, mul, sub
-        if (funct7 == 0x00) {
-          instname = "add";
-          insttype = ADD;
-        } else if (funct7 == 0x01) {
-          instname = "mul";
-          insttype = MUL;
-        } else if (funct7 == 0x20) {
-          instname = "sub";
-          insttype = SUB;
-        } else {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      case 0x1: // sll, mulh
-        if (funct7 == 0x00) {
-          instname = "sll";
-          insttype = SLL;
-        } else if (funct7 == 0x01) {
-          instname = "mulh";
-          insttype = MULH;
-        }
-        else {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      case 0x2: // slt
-        if (funct7 == 0x00) {
-          instname = "slt";
-          insttype = SLT;
-        } else {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      case 0x3: // sltu
-        if (funct7 == 0x00)
-        {
-          instname = "sltu";
-          insttype = SLTU;
-        }
-        else
-        {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      case 0x4: // xor div
-        if (funct7 == 0x00) {
-          instname = "xor";
-          insttype = XOR;
-        } else if (funct7 == 0x01) {
-          instname = "div";
-          insttype = DIV;
-        } else {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      case 0x5: // srl, sra
-        if (funct7 == 0x00) {
-          instname = "srl";
-          insttype = SRL;
-        } else if (funct7 == 0x20) {
-          instname = "sra";
-          insttype = SRA;
-        } else {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      case 0x6: // or, rem
-        if (funct7 == 0x00) {
-          instname = "or";
-          insttype = OR;
-        } else if (funct7 == 0x01) {
-          instname = "rem";
-          insttype = REM;
-        } else {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      case 0x7: // and
-        if (funct7 == 0x00) {
-          instname = "and";
-          insttype = AND;
-        } else {
-          this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
-        }
-        break;
-      default:
-        this->panic("Unknown Funct3 field %x\n", funct3);
-      }
-      op1str = REGNAME[rs1];
-      op2str = REGNAME[rs2];
-      deststr = REGNAME[rd];
-      inststr = instname + " " + deststr + "," + op1str + "," + op2str;
-      break;
-    case OP_IMM:
-      op1 = this->reg[rs1];
-      reg1 = rs1;
-      op2 = imm_i;
-      dest = rd;
-      switch (funct3) {
-      case 0x0:
-        instname = "addi";
-        insttype = ADDI;
-        break;
-      case 0x2:
-        instname = "slti";
-        insttype = SLTI;
-        break;
-      case 0x3:
-        instname = "sltiu";
-        insttype = SLTIU;
-        break;
-      case 0x4:
-        instname = "xori";
-        insttype = XORI;
-        break;
-      case 0x6:
-        instname = "ori";
-        insttype = ORI;
-        break;
-      case 0x7:
-        instname = "andi";
-        insttype = ANDI;
-        break;
-      case 0x1:
-        instname = "slli";
-        insttype = SLLI;
-        op2 = op2 & 0x3F;
-        break;
-      case 0x5:
-        if (((inst >> 26) & 0x3F) == 0x0) {
-          instname = "srli";
-          insttype = SRLI;
-          op2 = op2 & 0x3F;
-        } else if (((inst >> 26) & 0x3F) == 0x10) {
-          instname = "srai";
-          insttype = SRAI;
-          op2 = op2 & 0x3F;
-        } else {
-          this->panic("Unknown funct7 0x%x for OP_IMM\n", (inst >> 26) & 0x3F);
-        }
-        break;
-      default:
-        this->panic("Unknown Funct3 field %x\n", funct3);
-      }
-      op1str = REGNAME[rs1];
-      op2str = std::to_string(op2);
-      deststr = REGNAME[dest];
-      inststr = instname + " " + deststr + "," + op1str + "," + op2str;
-      break;
-    case OP_LUI:
-      op1 = imm_u;
-      op2 = 0;
-      offset = imm_u;
-      dest = rd;
-      instname = "lui";
-      insttype = LUI;
-      op1str = std::to_string(imm_u);
-      deststr = REGNAME[dest];
-      inststr = instname + " " + deststr + "," + op1str;
-      break;
-    case OP_AUIPC:
-      op1 = imm_u;
-      op2 = 0;
-      offset = imm_u;
-      dest = rd;
-      instname = "auipc";
-      insttype = AUIPC;
-      op1str = std::to_string(imm_u);
-      deststr = REGNAME[dest];
-      inststr = instname + " " + deststr + "," + op1str;
-      break;
-    case OP_JAL:
-      op1 = imm_uj;
-      op2 = 0;
-      offset = imm_uj;
-      dest = rd;
-      instname = "jal";
-      insttype = JAL;
-      op1str = std::to_string(imm_uj);
-      deststr = REGNAME[dest];
-      inststr = instname + " " + deststr + "," + op1str;
-      break;
-    case OP_JALR:
-      op1 = this->reg[rs1];
-      reg1 = rs1;
-      op2 = imm_i;
-      dest = rd;
-      instname = "jalr";
-      insttype = JALR;
-      op1str = REGNAME[rs1];
-      op2str = std::to_string(op2);
-      deststr = REGNAME[dest];
-      inststr = instname + " " + deststr + "," + op1str + "," + op2str;
-      break;
-    case OP_BRANCH:
-      op1 = this->reg[rs1];
-      op2 = this->reg[rs2];
-      reg1 = rs1;
-      reg2 = rs2;
-      offset = imm_sb;
-      switch (funct3) {
-      case 0x0:
-        instname = "beq";
-        insttype = BEQ;
-        break;
-      case 0x1:
-        instname = "bne";
-        insttype = BNE;
-        break;
-      case 0x4:
-        instname = "blt";
-        insttype = BLT;
-        break;
-      case 0x5:
-        instname = "bge";
-        insttype = BGE;
-        break;
-      case 0x6:
-        instname = "bltu";
-        insttype = BLTU;
-        break;
-      case 0x7:
-        instname = "bgeu";
-        insttype = BGEU;
-        break;
-      default:
-        this->panic("Unknown funct3 0x%x at OP_BRANCH\n", funct3);
-      }
-      op1str = REGNAME[rs1];
-      op2str = REGNAME[rs2];
-      offsetstr = std::to_string(offset);
-      inststr = instname + " " + op1str + "," + op2str + "," + offsetstr;
-      break;
-    case OP_STORE:
-      op1 = this->reg[rs1];
-      op2 = this->reg[rs2];
-      reg1 = rs1;
-      reg2 = rs2;
-      offset = imm_s;
-      switch (funct3) {
-      case 0x0:
-        instname = "sb";
-        insttype = SB;
-        break;
-      case 0x1:
-        instname = "sh";
-        insttype = SH;
-        break;
-      case 0x2:
-        instname = "sw";
-        insttype = SW;
-        break;
-      default:
-        this->panic("Unknown funct3 0x%x for OP_STORE\n", funct3);
-      }
-      op1str = REGNAME[rs1];
-      op2str = REGNAME[rs2];
-      offsetstr = std::to_string(offset);
-      inststr = instname + " " + op2str + "," + offsetstr + "(" + op1str + ")";
-      break;
-    case OP_LOAD:
-      op1 = this->reg[rs1];
-      reg1 = rs1;
-      op2 = imm_i;
-      offset = imm_i;
-      dest = rd;
-      switch (funct3) {
-      case 0x0:
-        instname = "lb";
-        insttype = LB;
-        break;
-      case 0x1:
-        instname = "lh";
-        insttype = LH;
-        break;
-      case 0x2:
-        instname = "lw";
-        insttype = LW;
-        break;
-      case 0x4:
-        instname = "lbu";
-        insttype = LBU;
-        break;
-      case 0x5:
-        instname = "lhu";
-        insttype = LHU;
-        break;
-      default:
-        this->panic("Unknown funct3 0x   for OP_LOAD\n", funct3);
-      }
-      op1str = REGNAME[rs1];
-      op2str = std::to_string(op2);
-      deststr = REGNAME[rd];
-      inststr = instname + " " + deststr + "," + op2str + "(" + op1str + ")";
-      break;
-    case OP_SYSTEM:
-      if (funct3 == 0x0 && funct7 == 0x000) {
-        instname = "ecall";
-        op1 = this->reg[REG_A0];
-        op2 = this->reg[REG_A7];
-        reg1 = REG_A0;
-        reg2 = REG_A7;
-        dest = REG_A0;
-        insttype = ECALL;
-      } else {
-        this->panic("Unknown OP_SYSTEM inst with funct3 0x%x and funct7 0x%x\n",
-                    funct3, funct7);
-      }
-      inststr = instname;
-      break;
-    case OP_FUSED:
-      if (funct3 == 0x0 && (funct2 == 0x0 || funct2 == 0x1)) {
-        instname = "fmadd";
-        insttype = FMADD;
-        op1 = this->reg[rs1];
-        op2 = this->reg[rs2];
-        op3 = this->reg[rs3];
-        reg1 = rs1;
-        reg2 = rs2;
-        reg3 = rs3;
-        dest = rd;
-      } else if (funct3 == 0x0 && (funct2 == 0x2 || funct2 == 0x3)) {
-        instname = "fmsub";
-        insttype = FMSUB;
-        op1 = this->reg[rs1];
-        op2 = this->reg[rs2];
-        op3 = this->reg[rs3];
-        reg1 = rs1;
-        reg2 = rs2;
-        reg3 = rs3;
-        dest = rd;
-      } else if (funct3 == 0x1 && funct2 == 0x0) {
-        instname = "fnmadd";
-        insttype = FNMADD;
-        op1 = this->reg[rs1];
-        op2 = this->reg[rs2];
-        op3 = this->reg[rs3];
-        reg1 = rs1;
-        reg2 = rs2;
-        reg3 = rs3;
-        dest = rd;
-      } else if (funct3 == 0x1 && funct2 == 0x1) {
-        instname = "fnmsub";
-        insttype = FNMSUB;
-        op1 = this->reg[rs1];
-        op2 = this->reg[rs2];
-        op3 = this->reg[rs3];
-        reg1 = rs1;
-        reg2 = rs2;
-        reg3 = rs3;
-        dest = rd;
-      } else {
-        this->panic("Unknown OP_FUSED inst with funct3 0x%x and funct2 0x%x\n",
-                    funct3, funct2);
-      }
-      break;
-    default:
-      this->panic("Unsupported opcode 0x%x!\n", opcode);
-    }
-
-    char buf[4096];
-    sprintf(buf, "0x%x: %s\n", this->fReg.pc, inststr.c_str());
-    this->history.instRecord.push_back(buf);
-
-    if (verbose) {
-      printf("Decoded instruction 0x%.8x as %s\n", inst, inststr.c_str());
-    }
-  } else { // 16 bit instruction
+  if (this->fReg.len != 4) { // 16 bit instruction
     this->panic(
         "Current implementation does not support 16bit RV64C instructions!\n");
   }
 
-  if (instname != INSTNAME[insttype]) {
-    this->panic("Unmatch instname %s with insttype %d\n", instname.c_str(),
-                insttype);
+  const DecodedInst &decoded =
+      this->getDecodedInst(this->fReg.pc, this->fReg.inst);
+  Inst insttype = decoded.inst;
+  RegId dest = decoded.dest;
+  RegId reg1 = decoded.rs1, reg2 = decoded.rs2, reg3 = decoded.rs3;
+  int32_t offset = decoded.offset;
+  // Register operands are read now, the rest come from the immediates
+  int32_t op1 = reg1 != RegId(-1) ? this->reg[reg1] : decoded.imm1;
+  int32_t op2 = reg2 != RegId(-1) ? this->reg[reg2] : decoded.imm2;
+  int32_t op3 = reg3 != RegId(-1) ? this->reg[reg3] : 0;
+
+  if (verbose) {
+    printf("Decoded instruction 0x%.8x as %s\n", this->fReg.inst,
+           this->disassemble(decoded).c_str());
   }
 
   bool predictedBranch = false;
@@ -682,6 +805,7 @@ void Simulator::decode() {
       this->dRegNew.predictedPC = this->fReg.pc + offset;
       this->dRegNew.anotherPC = this->fReg.pc + 4;
       this->fRegNew.bubble = true;
+      this->fRegNew.cause = CPI_BRANCH_REDIRECT;
     } else {
       this->dRegNew.anotherPC = this->fReg.pc + offset;
     }
@@ -689,10 +813,12 @@ void Simulator::decode() {
 
   this->dRegNew.stall = false;
   this->dRegNew.bubble = false;
+  this->dRegNew.traceId = this->fReg.traceId;
   this->dRegNew.rs1 = reg1;
   this->dRegNew.rs2 = reg2;
   this->dRegNew.rs3 = reg3;
   this->dRegNew.pc = this->fReg.pc;
+  this->dRegNew.rawInst = this->fReg.inst;
   this->dRegNew.inst = insttype;
   this->dRegNew.predictedBranch = predictedBranch;
   this->dRegNew.dest = dest;
@@ -702,12 +828,382 @@ void Simulator::decode() {
   this->dRegNew.offset = offset;
 }
 
+Simulator::DecodedInst &Simulator::getDecodedSlot(uint32_t pc) {
+  DecodedInst **&second = this->decodeTable[pc >> 22];
+  if (second == nullptr) {
+    second = new DecodedInst *[1024];
+    memset(second, 0, sizeof(DecodedInst *) * 1024);
+  }
+  DecodedInst *&page = second[(pc >> 12) & 0x3FF];
+  if (page == nullptr) {
+    page = new DecodedInst[1024];
+    for (uint32_t i = 0; i < 1024; ++i) {
+      page[i].valid = false;
+    }
+  }
+  return page[(pc >> 2) & 0x3FF];
+}
+
+const Simulator::DecodedInst &Simulator::getDecodedInst(uint32_t pc,
+                                                        uint32_t inst) {
+  DecodedInst &decoded = this->getDecodedSlot(pc);
+  if (!decoded.valid || decoded.pc != pc) {
+    this->decodeInst(pc, inst, decoded);
+  }
+  return decoded;
+}
+
+void Simulator::invalidateDecodedInst(uint32_t addr, uint32_t len) {
+  for (uint32_t a = addr & ~3u; a < addr + len; a += 4) {
+    DecodedInst **second = this->decodeTable[a >> 22];
+    if (second == nullptr || second[(a >> 12) & 0x3FF] == nullptr) {
+      continue;
+    }
+    second[(a >> 12) & 0x3FF][(a >> 2) & 0x3FF].valid = false;
+  }
+}
+
+void Simulator::decodeInst(uint32_t pc, uint32_t inst, DecodedInst &decoded) {
+  Inst insttype = Inst::UNKNOWN;
+  int32_t imm1 = 0, imm2 = 0, offset = 0; // used where no register is read
+  RegId dest = 0, reg1 = -1, reg2 = -1, reg3 = -1; // reg1 and reg2 are operands
+
+  uint32_t opcode = inst & 0x7F;
+  uint32_t funct3 = (inst >> 12) & 0x7;
+  uint32_t funct2 = (inst >> 25) & 0x3;
+  uint32_t funct7 = (inst >> 25) & 0x7F;
+  RegId rd = (inst >> 7) & 0x1F;
+  RegId rs1 = (inst >> 15) & 0x1F;
+  RegId rs2 = (inst >> 20) & 0x1F;
+  RegId rs3 = (inst >> 27) & 0xF;
+  int32_t imm_i = int32_t(inst) >> 20;
+  int32_t imm_s =
+      int32_t(((inst >> 7) & 0x1F) | ((inst >> 20) & 0xFE0)) << 20 >> 20;
+  int32_t imm_sb = int32_t(((inst >> 7) & 0x1E) | ((inst >> 20) & 0x7E0) |
+                           ((inst << 4) & 0x800) | ((inst >> 19) & 0x1000))
+                       << 19 >>
+                   19;
+  int32_t imm_u = int32_t(inst) >> 12;
+  int32_t imm_uj = int32_t(((inst >> 21) & 0x3FF) | ((inst >> 10) & 0x400) |
+                           ((inst >> 1) & 0x7F800) | ((inst >> 12) & 0x80000))
+                       << 12 >>
+                   11;
+
+  switch (opcode) {
+  case OP_REG:
+    reg1 = rs1;
+    reg2 = rs2;
+    dest = rd;
+    switch (funct3) {
+    case 0x0: // add, mul, sub
+      if (funct7 == 0x00) {
+        insttype = ADD;
+      } else if (funct7 == 0x01) {
+        insttype = MUL;
+      } else if (funct7 == 0x20) {
+        insttype = SUB;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    case 0x1: // sll, mulh
+      if (funct7 == 0x00) {
+        insttype = SLL;
+      } else if (funct7 == 0x01) {
+        insttype = MULH;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    case 0x2: // slt
+      if (funct7 == 0x00) {
+        insttype = SLT;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    case 0x3: // sltu
+      if (funct7 == 0x00) {
+        insttype = SLTU;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    case 0x4: // xor div
+      if (funct7 == 0x00) {
+        insttype = XOR;
+      } else if (funct7 == 0x01) {
+        insttype = DIV;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    case 0x5: // srl, sra
+      if (funct7 == 0x00) {
+        insttype = SRL;
+      } else if (funct7 == 0x20) {
+        insttype = SRA;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    case 0x6: // or, rem
+      if (funct7 == 0x00) {
+        insttype = OR;
+      } else if (funct7 == 0x01) {
+        insttype = REM;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    case 0x7: // and
+      if (funct7 == 0x00) {
+        insttype = AND;
+      } else {
+        this->panic("Unknown funct7 0x%x for funct3 0x%x\n", funct7, funct3);
+      }
+      break;
+    default:
+      this->panic("Unknown Funct3 field %x\n", funct3);
+    }
+    break;
+  case OP_IMM:
+    reg1 = rs1;
+    imm2 = imm_i;
+    dest = rd;
+    switch (funct3) {
+    case 0x0:
+      insttype = ADDI;
+      break;
+    case 0x2:
+      insttype = SLTI;
+      break;
+    case 0x3:
+      insttype = SLTIU;
+      break;
+    case 0x4:
+      insttype = XORI;
+      break;
+    case 0x6:
+      insttype = ORI;
+      break;
+    case 0x7:
+      insttype = ANDI;
+      break;
+    case 0x1:
+      insttype = SLLI;
+      imm2 = imm2 & 0x3F;
+      break;
+    case 0x5:
+      if (((inst >> 26) & 0x3F) == 0x0) {
+        insttype = SRLI;
+        imm2 = imm2 & 0x3F;
+      } else if (((inst >> 26) & 0x3F) == 0x10) {
+        insttype = SRAI;
+        imm2 = imm2 & 0x3F;
+      } else {
+        this->panic("Unknown funct7 0x%x for OP_IMM\n", (inst >> 26) & 0x3F);
+      }
+      break;
+    default:
+      this->panic("Unknown Funct3 field %x\n", funct3);
+    }
+    break;
+  case OP_LUI:
+    imm1 = imm_u;
+    offset = imm_u;
+    dest = rd;
+    insttype = LUI;
+    break;
+  case OP_AUIPC:
+    imm1 = imm_u;
+    offset = imm_u;
+    dest = rd;
+    insttype = AUIPC;
+    break;
+  case OP_JAL:
+    imm1 = imm_uj;
+    offset = imm_uj;
+    dest = rd;
+    insttype = JAL;
+    break;
+  case OP_JALR:
+    reg1 = rs1;
+    imm2 = imm_i;
+    dest = rd;
+    insttype = JALR;
+    break;
+  case OP_BRANCH:
+    reg1 = rs1;
+    reg2 = rs2;
+    offset = imm_sb;
+    switch (funct3) {
+    case 0x0:
+      insttype = BEQ;
+      break;
+    case 0x1:
+      insttype = BNE;
+      break;
+    case 0x4:
+      insttype = BLT;
+      break;
+    case 0x5:
+      insttype = BGE;
+      break;
+    case 0x6:
+      insttype = BLTU;
+      break;
+    case 0x7:
+      insttype = BGEU;
+      break;
+    default:
+      this->panic("Unknown funct3 0x%x at OP_BRANCH\n", funct3);
+    }
+    break;
+  case OP_STORE:
+    reg1 = rs1;
+    reg2 = rs2;
+    offset = imm_s;
+    switch (funct3) {
+    case 0x0:
+      insttype = SB;
+      break;
+    case 0x1:
+      insttype = SH;
+      break;
+    case 0x2:
+      insttype = SW;
+      break;
+    default:
+      this->panic("Unknown funct3 0x%x for OP_STORE\n", funct3);
+    }
+    break;
+  case OP_LOAD:
+    reg1 = rs1;
+    imm2 = imm_i;
+    offset = imm_i;
+    dest = rd;
+    switch (funct3) {
+    case 0x0:
+      insttype = LB;
+      break;
+    case 0x1:
+      insttype = LH;
+      break;
+    case 0x2:
+      insttype = LW;
+      break;
+    case 0x4:
+      insttype = LBU;
+      break;
+    case 0x5:
+      insttype = LHU;
+      break;
+    default:
+      this->panic("Unknown funct3 0x%x for OP_LOAD\n", funct3);
+    }
+    break;
+  case OP_SYSTEM:
+    if (funct3 == 0x0 && funct7 == 0x000) {
+      reg1 = REG_A0;
+      reg2 = REG_A7;
+      dest = REG_A0;
+      insttype = ECALL;
+    } else {
+      this->panic("Unknown OP_SYSTEM inst with funct3 0x%x and funct7 0x%x\n",
+                  funct3, funct7);
+    }
+    break;
+  case OP_FUSED:
+    reg1 = rs1;
+    reg2 = rs2;
+    reg3 = rs3;
+    dest = rd;
+    if (funct3 == 0x0 && (funct2 == 0x0 || funct2 == 0x1)) {
+      insttype = FMADD;
+    } else if (funct3 == 0x0 && (funct2 == 0x2 || funct2 == 0x3)) {
+      insttype = FMSUB;
+    } else if (funct3 == 0x1 && funct2 == 0x0) {
+      insttype = FNMADD;
+    } else if (funct3 == 0x1 && funct2 == 0x1) {
+      insttype = FNMSUB;
+    } else {
+      this->panic("Unknown OP_FUSED inst with funct3 0x%x and funct2 0x%x\n",
+                  funct3, funct2);
+    }
+    break;
+  default:
+    this->panic("Unsupported opcode 0x%x!\n", opcode);
+  }
+
+  decoded.valid = true;
+  decoded.pc = pc;
+  decoded.raw = inst;
+  decoded.inst = insttype;
+  decoded.rs1 = reg1;
+  decoded.rs2 = reg2;
+  decoded.rs3 = reg3;
+  decoded.dest = dest;
+  decoded.imm1 = imm1;
+  decoded.imm2 = imm2;
+  decoded.offset = offset;
+}
+
+std::string Simulator::disassemble(const DecodedInst &decoded) {
+  std::string instname = INSTNAME[decoded.inst];
+  switch (decoded.inst) {
+  case LUI:
+  case AUIPC:
+  case JAL:
+    return instname + " " + REGNAME[decoded.dest] + "," +
+           std::to_string(decoded.imm1);
+  case BEQ:
+  case BNE:
+  case BLT:
+  case BGE:
+  case BLTU:
+  case BGEU:
+    return instname + " " + REGNAME[decoded.rs1] + "," +
+           REGNAME[decoded.rs2] + "," + std::to_string(decoded.offset);
+  case SB:
+  case SH:
+  case SW:
+    return instname + " " + REGNAME[decoded.rs2] + "," +
+           std::to_string(decoded.offset) + "(" + REGNAME[decoded.rs1] + ")";
+  case LB:
+  case LH:
+  case LW:
+  case LBU:
+  case LHU:
+    return instname + " " + REGNAME[decoded.dest] + "," +
+           std::to_string(decoded.imm2) + "(" + REGNAME[decoded.rs1] + ")";
+  case ECALL:
+    return instname;
+  case FMADD:
+  case FMSUB:
+  case FNMADD:
+  case FNMSUB:
+    return instname + " " + REGNAME[decoded.dest] + "," +
+           REGNAME[decoded.rs1] + "," + REGNAME[decoded.rs2] + "," +
+           REGNAME[decoded.rs3];
+  default:
+    break;
+  }
+  // Register-register and register-immediate arithmetic, and jalr
+  std::string op2str = decoded.rs2 != RegId(-1)
+                           ? std::string(REGNAME[decoded.rs2])
+                           : std::to_string(decoded.imm2);
+  return instname + " " + REGNAME[decoded.dest] + "," + REGNAME[decoded.rs1] +
+         "," + op2str;
+}
+
 void Simulator::excecute() {
   if (this->dReg.stall) {
     if (verbose) {
       printf("Execute: Stall\n");
     }
     this->eRegNew.bubble = true;
+    this->eRegNew.cause = CPI_LOAD_USE;
     return;
   }
   if (this->dReg.bubble) {
@@ -715,6 +1211,7 @@ void Simulator::excecute() {
       printf("Execute: Bubble\n");
     }
     this->eRegNew.bubble = true;
+    this->eRegNew.cause = this->dReg.cause;
     return;
   }
 
@@ -723,6 +1220,13 @@ void Simulator::excecute() {
   }
 
   this->history.instCount++;
+  if (this->pipeTracer != nullptr) {
+    const DecodedInst &decoded = this->getDecodedSlot(this->dReg.pc);
+    if (decoded.valid && decoded.raw == this->dReg.rawInst) {
+      this->pipeTracer->label(this->dReg.traceId,
+                              this->disassemble(decoded).c_str());
+    }
+  }
 
   Inst inst = this->dReg.inst;
   int32_t op1 = this->dReg.op1;
@@ -862,6 +1366,10 @@ void Simulator::excecute() {
     writeReg = true;
     out = op1 * op2;
     this->history.cycleCount += 3;
+    this->history.cpiStack[CPI_EXECUTE] += 3;
+    if (this->pcProfiler != nullptr) {
+      this->pcProfiler->addExecuteCycles(this->dReg.pc, 3);
+    }
     break;
   case DIV:
     writeReg = true;
@@ -915,26 +1423,46 @@ void Simulator::excecute() {
     writeReg = true;
     out = op1 * op2 + op3;
     this->history.cycleCount += 3;
+    this->history.cpiStack[CPI_EXECUTE] += 3;
+    if (this->pcProfiler != nullptr) {
+      this->pcProfiler->addExecuteCycles(this->dReg.pc, 3);
+    }
     break;
   case FMSUB:
     writeReg = true;
     out = op1 * op2 - op3;
     this->history.cycleCount += 3;
+    this->history.cpiStack[CPI_EXECUTE] += 3;
+    if (this->pcProfiler != nullptr) {
+      this->pcProfiler->addExecuteCycles(this->dReg.pc, 3);
+    }
     break;
   case FNMADD:
     writeReg = true;
     out = -op1 * op2 + op3;
     this->history.cycleCount += 3;
+    this->history.cpiStack[CPI_EXECUTE] += 3;
+    if (this->pcProfiler != nullptr) {
+      this->pcProfiler->addExecuteCycles(this->dReg.pc, 3);
+    }
     break;
   case FNMSUB:
     writeReg = true;
     out = -op1 * op2 - op3;
     this->history.cycleCount += 3;
+    this->history.cpiStack[CPI_EXECUTE] += 3;
+    if (this->pcProfiler != nullptr) {
+      this->pcProfiler->addExecuteCycles(this->dReg.pc, 3);
+    }
     break;
   default:
     this->panic("Unknown instruction type %d\n", inst);
   }
 
+  if (this->bbvProfiler != nullptr) {
+    this->bbvProfiler->retire(this->dReg.pc, isBranch(inst) || isJump(inst));
+  }
+
   // Pipeline Related Code
   if (isBranch(inst)) {
     if (predictedBranch == branch) {
@@ -945,8 +1473,13 @@ void Simulator::excecute() {
       this->isJumporBranch = true;
       this->fRegNew.bubble = true;
       this->dRegNew.bubble = true;
+      this->fRegNew.cause = CPI_BRANCH_MISPREDICT;
+      this->dRegNew.cause = CPI_BRANCH_MISPREDICT;
       this->history.unpredictedBranch++;
       this->history.controlHazardCount++;
+      if (this->pcProfiler != nullptr) {
+        this->pcProfiler->mispredict(this->dReg.pc);
+      }
     }
     // this->dReg.pc: fetch original inst addr, not the modified one
     this->branchPredictor->update(this->dReg.pc, branch);
@@ -957,6 +1490,8 @@ void Simulator::excecute() {
     this->isJumporBranch = true;
     this->fRegNew.bubble = true;
     this->dRegNew.bubble = true;
+    this->fRegNew.cause = CPI_JUMP;
+    this->dRegNew.cause = CPI_JUMP;
     this->history.controlHazardCount++;
   }
   if (isReadMem(inst)) {
@@ -966,10 +1501,17 @@ void Simulator::excecute() {
         this->dRegNew.stall = 2;
         this->eRegNew.bubble = true;
         this->history.cycleCount--;
+        this->history.cpiStack[CPI_LOAD_USE]--;
         this->history.memoryHazardCount++;
+        if (this->pcProfiler != nullptr) {
+          // Of the two bubbles charged to the dependent instruction, one is
+          // not a real cycle
+          this->pcProfiler->addStallCycles(this->dRegNew.pc, -1);
+        }
       }
       else {
         this->stallCnt = 3;
+        this->stallCause = CPI_LOAD_USE;
         this->history.memoryHazardCount++;
       }
     }
@@ -988,6 +1530,7 @@ void Simulator::excecute() {
       }
       else {
         this->stallCnt = 3;
+        this->stallCause = CPI_DATA_HAZARD;
         this->history.dataHazardCount++;
       }
     }
@@ -1002,6 +1545,7 @@ void Simulator::excecute() {
       }
       else {
         this->stallCnt = 3;
+        this->stallCause = CPI_DATA_HAZARD;
         this->history.dataHazardCount++;
       }
     }
@@ -1016,6 +1560,7 @@ void Simulator::excecute() {
       }
       else {
         this->stallCnt = 3;
+        this->stallCause = CPI_DATA_HAZARD;
         this->history.dataHazardCount++;
       }
     }
@@ -1023,7 +1568,10 @@ void Simulator::excecute() {
 
   this->eRegNew.bubble = false;
   this->eRegNew.stall = false;
+  this->eRegNew.traceId = this->dReg.traceId;
   this->eRegNew.pc = dRegPC;
+  this->eRegNew.instPC = this->dReg.pc;
+  this->eRegNew.rawInst = this->dReg.rawInst;
   this->eRegNew.inst = inst;
   this->eRegNew.op1 = op1; // for jalr
   this->eRegNew.op2 = op2; // for store
@@ -1050,6 +1598,7 @@ void Simulator::memoryAccess() {
       printf("Memory Access: Bubble\n");
     }
     this->mRegNew.bubble = true;
+    this->mRegNew.cause = this->eReg.cause;
     return;
   }
 
@@ -1069,6 +1618,31 @@ void Simulator::memoryAccess() {
   bool good = true;
   uint32_t cycles = 0;
 
+  // The Zihintntl hints ntl.p1, ntl.pall, ntl.s1 and ntl.all, encoded as
+  // add x0, x0, x2 to x5, apply to the instruction after them. Its misses
+  // skip L1, the private L1 and L2, or every level down to L3.
+  uint32_t bypassLevels = this->bypassHint;
+  switch (this->eReg.rawInst) {
+  case 0x00200033:
+    this->bypassHint = 1;
+    break;
+  case 0x00300033:
+    this->bypassHint = 2;
+    break;
+  case 0x00400033:
+  case 0x00500033:
+    this->bypassHint = 3;
+    break;
+  default:
+    this->bypassHint = 0;
+  }
+
+  // Prefetchers train on the PC of the access
+  Cache *cache = this->memory->getCache();
+  if ((writeMem || readMem) && cache != nullptr) {
+    cache->setAccessInfo(eRegPC, this->history.cycleCount, bypassLevels);
+  }
+
   if (writeMem) {
     switch (memLen) {
     case 1:
@@ -1088,6 +1662,9 @@ void Simulator::memoryAccess() {
   if (!good) {
     this->panic("Invalid Mem Access!\n");
   }
+  if (writeMem) {
+    this->invalidateDecodedInst(out, memLen);
+  }
 
   if (readMem) {
     switch (memLen) {
@@ -1117,8 +1694,30 @@ void Simulator::memoryAccess() {
     }
   }
 
+  // A non-blocking cache holds the pipeline only until it accepts the
+  // request, the data of a load is waited for by the first instruction
+  // that needs it
+  if ((writeMem || readMem) && cache != nullptr && cache->isNonBlocking()) {
+    Cache::Timing timing = cache->getLastTiming();
+    cycles = uint32_t(timing.accept - this->history.cycleCount);
+    if (readMem && writeReg && destReg != 0) {
+      PendingLoad &load = this->pendingLoad[destReg];
+      // The data reaches execute the cycle after it arrives, as it does
+      // after a blocking access
+      load.ready = timing.ready + 1;
+      load.cause = this->getDataCacheComponent();
+      load.pc = this->eReg.instPC;
+    }
+  }
+
   //if (cycles != 0) printf("%d\n", cycles);
   this->history.cycleCount += cycles;
+  if (cycles != 0) {
+    this->history.cpiStack[this->getDataCacheComponent()] += cycles;
+  }
+  if (this->pcProfiler != nullptr && cycles != 0) {
+    this->pcProfiler->addMemoryCycles(this->eReg.instPC, cycles);
+  }
 
   if (verbose) {
     printf("Memory Access: %s\n", INSTNAME[inst]);
@@ -1179,6 +1778,7 @@ void Simulator::memoryAccess() {
       if (this->stallCnt == 0 && !this->isJumporBranch) {
         if (this->dRegNew.rs1 == destReg || this->dRegNew.rs2 == destReg || this->dRegNew.rs3 == destReg) {
           this->stallCnt = 2;
+          this->stallCause = CPI_DATA_HAZARD;
           this->history.dataHazardCount++;
         }
       }
@@ -1187,7 +1787,10 @@ void Simulator::memoryAccess() {
 
   this->mRegNew.bubble = false;
   this->mRegNew.stall = false;
+  this->mRegNew.traceId = this->eReg.traceId;
   this->mRegNew.pc = eRegPC;
+  this->mRegNew.instPC = this->eReg.instPC;
+  this->mRegNew.rawInst = this->eReg.rawInst;
   this->mRegNew.inst = inst;
   this->mRegNew.op1 = op1;
   this->mRegNew.op2 = op2;
@@ -1197,6 +1800,33 @@ void Simulator::memoryAccess() {
   this->mRegNew.out = out;
 }
 
+// Stalls the instruction that executed this cycle until the loads writing
+// its source or destination registers have their data
+void Simulator::waitForPendingLoads() {
+  const RegId regs[4] = {this->dReg.rs1, this->dReg.rs2, this->dReg.rs3,
+                         this->dReg.dest};
+  const PendingLoad *last = nullptr;
+  for (RegId reg : regs) {
+    if (reg == 0 || reg >= REGNUM) {
+      continue;
+    }
+    const PendingLoad &load = this->pendingLoad[reg];
+    if (load.ready > this->history.cycleCount &&
+        (last == nullptr || load.ready > last->ready)) {
+      last = &load;
+    }
+  }
+  if (last == nullptr) {
+    return;
+  }
+  uint32_t cycles = uint32_t(last->ready - this->history.cycleCount);
+  this->history.cycleCount += cycles;
+  this->history.cpiStack[last->cause] += cycles;
+  if (this->pcProfiler != nullptr) {
+    this->pcProfiler->addMemoryCycles(last->pc, cycles);
+  }
+}
+
 void Simulator::writeBack() {
   if (this->mReg.stall) {
     if (verbose) {
@@ -1208,12 +1838,17 @@ void Simulator::writeBack() {
     if (verbose) {
       printf("WriteBack: Bubble\n");
     }
+    this->history.cpiStack[this->mReg.cause]++;
+    if (this->pcProfiler != nullptr) {
+      this->pcProfiler->stallCycle();
+    }
     return;
   }
 
   if (verbose) {
     printf("WriteBack: %s\n", INSTNAME[this->mReg.inst]);
   }
+  this->history.cpiStack[CPI_BASE]++;
 
   if (this->mReg.writeReg && this->mReg.destReg != 0) {
     // Check for data hazard and forward data
@@ -1272,6 +1907,7 @@ void Simulator::writeBack() {
          this->dRegNew.rs3 == this->mReg.destReg) {
           if (stallCnt == 0&& !this->isJumporBranch) {
             stallCnt = 1;
+            this->stallCause = CPI_DATA_HAZARD;
             this->history.dataHazardCount ++;
           }
       }
@@ -1280,6 +1916,16 @@ void Simulator::writeBack() {
     this->reg[this->mReg.destReg] = this->mReg.out;
   }
 
+  if (this->pcProfiler != nullptr) {
+    this->pcProfiler->retire(this->mReg.instPC);
+  }
+  if (this->shouldDumpHistory) {
+    this->recordHistory(this->history.cycleCount, this->mReg.instPC,
+                        this->mReg.rawInst,
+                        this->mReg.writeReg ? this->mReg.destReg : 0,
+                        this->mReg.out);
+  }
+
   // this->pc = this->mReg.pc;
 }
 
@@ -1305,6 +1951,9 @@ int32_t Simulator::handleSystemCall(int32_t op1, int32_t op2) {
   case 3:
   case 93: // exit
     printf("Program exit from an exit() system call\n");
+    if (this->bbvProfiler != nullptr) {
+      this->bbvProfiler->close();
+    }
     if (shouldDumpHistory) {
       printf("Dumping history to dump.txt...");
       this->dumpHistory();
@@ -1336,7 +1985,16 @@ void Simulator::printInfo() {
 
 void Simulator::printStatistics() {
   printf("------------ STATISTICS -----------\n");
+  if (this->fastForwarded > 0) {
+    printf("Fast-forwarded Instructions: %" PRIu64 "\n",
+           this->fastForwarded);
+  }
   printf("Number of Instructions: %u\n", this->history.instCount);
+  if (this->functional) {
+    printf("Functional simulation, no timing collected\n");
+    printf("-----------------------------------\n");
+    return;
+  }
   printf("Number of Cycles: %u\n", this->history.cycleCount);
   printf("Avg Cycles per Instrcution: %.4f\n",
          (float)this->history.cycleCount / this->history.instCount);
@@ -1349,10 +2007,84 @@ void Simulator::printStatistics() {
   printf("Number of Data Hazards: %u\n", this->history.dataHazardCount);
   printf("Number of Memory Hazards: %u\n",
          this->history.memoryHazardCount);
+  printf("------------ CPI STACK ------------\n");
+  int64_t total = 0;
+  for (int i = 0; i < CPI_NUM; ++i) {
+    total += this->history.cpiStack[i];
+    printf("%-18s %12" PRId64 " cycles  CPI %.4f  %6.2f%%\n", CPINAME[i],
+           this->history.cpiStack[i],
+           (double)this->history.cpiStack[i] / this->history.instCount,
+           100.0 * this->history.cpiStack[i] / this->history.cycleCount);
+  }
+  printf("%-18s %12" PRId64 " cycles  CPI %.4f\n", "Total", total,
+         (double)total / this->history.instCount);
+  this->printCacheStatistics();
   printf("-----------------------------------\n");
+  if (this->pcProfiler != nullptr) {
+    this->pcProfiler->flush(this->getOldestInstPC());
+    this->pcProfiler->printReport(10);
+    this->pcProfiler->close();
+  }
+  if (this->pipeTracer != nullptr) {
+    this->pipeTracer->close();
+  }
   //this->memory->printStatistics();
 }
 
+// One line per cache, the instruction cache first when fetches have their
+// own, then the data side from L1 down
+void Simulator::printCacheStatistics() {
+  Cache *instCache = this->memory->getInstCache();
+  Cache *cache = this->memory->getCache();
+  if (cache == nullptr) {
+    return;
+  }
+  printf("-------- CACHE STATISTICS ---------\n");
+  if (instCache != nullptr) {
+    this->printCacheLine("L1I", instCache);
+  }
+  std::string name = instCache != nullptr ? "L1D" : "L1";
+  for (int level = 1; cache != nullptr; ++level) {
+    this->printCacheLine(name.c_str(), cache);
+    cache = cache->getLowerCache();
+    name = "L" + std::to_string(level + 1);
+  }
+}
+
+void Simulator::printCacheLine(const char *name, Cache *cache) {
+  const Cache::Statistics &stats = cache->statistics;
+  uint32_t accesses = stats.numHit + stats.numMiss;
+  printf("%-4s %10u reads %10u writes %10u misses  Miss Rate %.4f  "
+         "AMAT %.2f\n",
+         name, stats.numRead, stats.numWrite, stats.numMiss,
+         accesses != 0 ? (double)stats.numMiss / accesses : 0.0,
+         accesses != 0 ? (double)stats.totalCycles / accesses : 0.0);
+  cache->getReplacementPolicy()->printStatistics();
+  if (stats.numPrefetch != 0) {
+    printf("Prefetch: %u issued, %u useful, %u late, %u unused, %u "
+           "polluting\n",
+           stats.numPrefetch, stats.numPrefetchUseful, stats.numPrefetchLate,
+           stats.numPrefetchUnused, stats.numPrefetchPolluting);
+  }
+  if (cache->isNonBlocking()) {
+    printf("MSHR: %u merged, %u waited for a free MSHR, MLP %.2f\n",
+           stats.numMSHRMerge, stats.numMSHRFull,
+           stats.missActiveCycles != 0
+               ? (double)stats.missCycles / stats.missActiveCycles
+               : 0.0);
+  }
+  if (stats.numBypass != 0) {
+    printf("Bypass: %u misses did not allocate a line\n", stats.numBypass);
+  }
+  if (stats.numBackInvalidate != 0 || stats.numVictimInsert != 0 ||
+      stats.numPassThrough != 0) {
+    printf("Inclusion: %u lines invalidated from below, %u victims taken "
+           "from above, %u writes passed through\n",
+           stats.numBackInvalidate, stats.numVictimInsert,
+           stats.numPassThrough);
+  }
+}
+
 std::string Simulator::getRegInfoStr() {
   std::string str;
   char buf[65536];
@@ -1376,10 +2108,24 @@ void Simulator::dumpHistory() {
   std::ofstream ofile("dump.txt");
   ofile << "================== Excecution History =================="
         << std::endl;
-  for (uint32_t i = 0; i < this->history.instRecord.size(); ++i) {
-    ofile << this->history.instRecord[i];
-    ofile << this->history.regRecord[i];
+  // Oldest record first
+  char buf[4096];
+  uint32_t first = (this->history.nextRecord + HISTORY_SIZE -
+                    this->history.recordCount) % HISTORY_SIZE;
+  for (uint32_t i = 0; i < this->history.recordCount; ++i) {
+    const HistoryRecord &record =
+        this->history.records[(first + i) % HISTORY_SIZE];
+    DecodedInst decoded;
+    this->decodeInst(record.pc, record.inst, decoded);
+    int len = sprintf(buf, "[%u] 0x%x: %s", record.cycle, record.pc,
+                      this->disassemble(decoded).c_str());
+    if (record.destReg != 0) {
+      sprintf(buf + len, "  %s <- 0x%.8x(%d)", REGNAME[record.destReg],
+              record.value, record.value);
+    }
+    ofile << buf << "\n";
   }
+  ofile << this->getRegInfoStr();
   ofile << "========================================================"
         << std::endl;
   ofile << std::endl;
@@ -1403,5 +2149,9 @@ void Simulator::panic(const char *format, ...) {
   va_end(args);
   this->dumpHistory();
   fprintf(stderr, "Execution history and memory dump in dump.txt\n");
+  if (this->pipeTracer != nullptr) {
+    // Keep the timeline leading up to the failure
+    this->pipeTracer->close();
+  }
   exit(-1);
 }
@@ -12,8 +12,28 @@
 #include <string>
 #include <vector>
 
+#include "BBVProfiler.h"
 #include "BranchPredictor.h"
 #include "MemoryManager.h"
+#include "PCProfiler.h"
+#include "PipeTracer.h"
+
+// Checkpoint file layout, all integers little-endian
+//   Header     char magic[8]       "RVCKPT\0\0"
+//              uint32_t version    CHECKPOINT_VERSION
+//              uint32_t flags      CHECKPOINT_FLAG_WARM with predictor and
+//                                  cache state
+//   CPU        uint32_t pc, reg[32], stackBase, maximumStackSize
+//              uint64_t instCount  instructions executed before the point
+//   Memory     uint32_t pageNum, then pageNum x {uint32_t addr, 4096 bytes}
+//   Predictor  BranchPredictor::saveState, only with CHECKPOINT_FLAG_WARM
+//   Caches     Cache::saveState from L1 down, only with CHECKPOINT_FLAG_WARM
+//   I-cache    Cache::saveState of the L1 instruction cache alone, only with
+//              CHECKPOINT_FLAG_ICACHE
+const char CHECKPOINT_MAGIC[8] = {'R', 'V', 'C', 'K', 'P', 'T', '\0', '\0'};
+const uint32_t CHECKPOINT_VERSION = 3;
+const uint32_t CHECKPOINT_FLAG_WARM = 0x1;
+const uint32_t CHECKPOINT_FLAG_ICACHE = 0x2;
 
 namespace RISCV {
 
@@ -158,20 +178,47 @@ public:
   bool verbose;
   bool shouldDumpHistory;
   bool dataforwarding;
+  // Instructions run on the functional model before the pipeline starts,
+  // warming the caches and the branch predictor, 0 for none
+  uint64_t fastForwardInst;
+  // Fast-forwarding also stops at the first execution of this PC
+  bool hasFastForwardMarker;
+  uint32_t fastForwardMarker;
+  // The detailed region ends after this many instructions, 0 for no limit
+  uint32_t maxDetailedInst;
   uint32_t pc;
   uint32_t reg[RISCV::REGNUM];
   uint32_t stackBase;
   uint32_t maximumStackSize;
   MemoryManager *memory;
   BranchPredictor *branchPredictor;
+  BBVProfiler *bbvProfiler; // nullptr unless profiling basic blocks
+  PCProfiler *pcProfiler;   // nullptr unless attributing cycles to PCs
+  PipeTracer *pipeTracer;   // nullptr unless writing a pipeline timeline
 
   Simulator(MemoryManager *memory, BranchPredictor *predictor);
   ~Simulator();
 
   void initStack(uint32_t baseaddr, uint32_t maxSize);
 
+  // Fast-forwards if requested, then runs the pipeline until the program
+  // exits or maxDetailedInst instructions have been executed
   void simulate();
 
+  // Runs the program on a plain interpreter without the pipeline and caches,
+  // only instruction counts are collected
+  void simulateFunctional();
+
+  // Runs the fastForwardInst / fastForwardMarker prefix functionally, with
+  // warmUp the caches and the branch predictor are trained on the way
+  void fastForward(bool warmUp);
+
+  // The pipeline is empty between instructions, so a checkpoint holds the
+  // architectural state, plus the cache and predictor state when the
+  // memory has caches attached
+  bool saveCheckpoint(const char *path);
+  bool loadCheckpoint(const char *path);
+
   void dumpHistory();
 
   void printInfo();
@@ -179,15 +226,40 @@ public:
   void printStatistics();
 
 private:
+  // Components of the CPI stack, every simulated cycle is charged to exactly
+  // one of them
+  enum CPIComponent {
+    CPI_BASE = 0,          // an instruction retired, or the pipeline filling
+    CPI_DATA_HAZARD,       // stalls waiting for a register without forwarding
+    CPI_LOAD_USE,          // stalls waiting for a load result
+    CPI_BRANCH_MISPREDICT, // instructions flushed by a mispredicted branch
+    CPI_BRANCH_REDIRECT,   // fetch slot lost to a taken prediction in decode
+    CPI_JUMP,              // instructions flushed by a jump
+    CPI_ICACHE,            // instruction fetch misses
+    CPI_DCACHE_L1,         // data accesses, by the level that served them
+    CPI_DCACHE_L2,
+    CPI_DCACHE_L3,
+    CPI_DCACHE_MEMORY,
+    CPI_EXECUTE,           // extra cycles of multi-cycle execute units
+    CPI_NUM,
+  };
+  static const char *CPINAME[CPI_NUM];
+
+  bool functional;
+  uint64_t fastForwarded; // instructions skipped before the detailed region
   int stallCnt;
   int rstPcCnt;
   bool forwardFetcher;
   bool isJumporBranch;
+  CPIComponent stallCause; // why the stallCnt bubbles are inserted
   uint32_t rstPc;
   struct FReg {
     // Control Signals
     bool bubble;
     uint32_t stall;
+    CPIComponent cause; // what a bubble is charged to
+
+    uint32_t traceId; // PipeTracer id, 0 when not traced
 
     uint32_t pc;
     uint32_t inst;
@@ -197,9 +269,12 @@ private:
     // Control Signals
     bool bubble;
     uint32_t stall;
+    CPIComponent cause;
     RISCV::RegId rs1, rs2, rs3;
+    uint32_t traceId;
 
     uint32_t pc;
+    uint32_t rawInst;
     RISCV::Inst inst;
     int32_t op1;
     int32_t op2;
@@ -214,8 +289,12 @@ private:
     // Control Signals
     bool bubble;
     uint32_t stall;
+    CPIComponent cause;
+    uint32_t traceId;
 
     uint32_t pc;
+    uint32_t instPC; // pc of the instruction itself, pc may be a jump target
+    uint32_t rawInst;
     RISCV::Inst inst;
     int32_t op1;
     int32_t op2;
@@ -233,8 +312,12 @@ private:
     // Control Signals
     bool bubble;
     uint32_t stall;
+    CPIComponent cause;
+    uint32_t traceId;
 
     uint32_t pc;
+    uint32_t instPC;
+    uint32_t rawInst;
     RISCV::Inst inst;
     int32_t op1;
     int32_t op2;
@@ -251,6 +334,27 @@ private:
   bool memoryWriteBack;
   RISCV::RegId memoryWBReg;
 
+  // Loads still waiting for a non-blocking data cache, by destination
+  // register. Entries whose ready cycle has passed are stale.
+  struct PendingLoad {
+    uint64_t ready; // first cycle execute can use the result
+    CPIComponent cause;
+    uint32_t pc;
+  } pendingLoad[RISCV::REGNUM];
+  // Cache levels the misses of the next memory access skip, set by a
+  // non-temporal locality hint
+  uint32_t bypassHint;
+
+  // One retired instruction in the execution history
+  struct HistoryRecord {
+    uint32_t cycle;
+    uint32_t pc;
+    uint32_t inst;
+    RISCV::RegId destReg; // 0 if no register was written
+    uint32_t value;
+  };
+  static const uint32_t HISTORY_SIZE = 100000;
+
   struct History {
     uint32_t instCount;
     uint32_t cycleCount;
@@ -264,20 +368,63 @@ private:
     uint32_t controlHazardCount;
     uint32_t memoryHazardCount;
 
-    std::vector<std::string> instRecord;
-    std::vector<std::string> regRecord;
+    int64_t cpiStack[CPI_NUM]; // cycles charged to each CPIComponent
+
+    // Ring buffer of the last HISTORY_SIZE retired instructions, only
+    // allocated when shouldDumpHistory is set
+    std::vector<HistoryRecord> records;
+    uint32_t nextRecord;
+    uint32_t recordCount;
 
     std::string memoryDump;
   } history;
 
+  // Decoded form of a static instruction. Operands with a register index of
+  // -1 take the corresponding immediate instead.
+  struct DecodedInst {
+    bool valid;
+    uint32_t pc;
+    uint32_t raw;
+    RISCV::Inst inst;
+    RISCV::RegId rs1, rs2, rs3;
+    RISCV::RegId dest;
+    int32_t imm1;
+    int32_t imm2;
+    int32_t offset;
+  };
+  // Decoded instructions by PC, a two-level table of 4 KiB pages filled
+  // lazily in decode and invalidated by stores
+  DecodedInst **decodeTable[1024];
+
   void fetch();
   void decode();
   void excecute();
   void memoryAccess();
   void writeBack();
+  void waitForPendingLoads();
 
   int32_t handleSystemCall(int32_t op1, int32_t op2);
 
+  void executeFunctional(uint64_t instNum, bool stopAtMarker, bool warmUp);
+  void resetHistory();
+  void resetStatistics();
+  void recordHistory(uint32_t cycle, uint32_t pc, uint32_t inst,
+                     RISCV::RegId destReg, uint32_t value);
+  void waitForSingleStep();
+  uint32_t getOldestInstPC();
+  void tracePipeline();
+  uint32_t traceStage(uint32_t id, uint32_t pc, PipeTracer::Stage stage);
+  void traceForwarding();
+  CPIComponent getDataCacheComponent();
+
+  DecodedInst &getDecodedSlot(uint32_t pc);
+  const DecodedInst &getDecodedInst(uint32_t pc, uint32_t inst);
+  void decodeInst(uint32_t pc, uint32_t inst, DecodedInst &decoded);
+  void invalidateDecodedInst(uint32_t addr, uint32_t len);
+  std::string disassemble(const DecodedInst &decoded);
+
+  void printCacheStatistics();
+  void printCacheLine(const char *name, Cache *cache);
   std::string getRegInfoStr();
   void panic(const char *format, ...);
 };
@@ -0,0 +1,113 @@
+/*
+ * Implementation of the LRU stack distance engine
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "StackDistance.h"
+
+StackDistance::StackDistance(uint32_t blockSize, uint32_t setNum,
+                             uint32_t maxAssociativity) {
+  if (maxAssociativity == 0 || maxAssociativity > MAX_ASSOCIATIVITY ||
+      (maxAssociativity & (maxAssociativity - 1)) != 0) {
+    fprintf(stderr, "Invalid maximum associativity %d\n", maxAssociativity);
+    exit(-1);
+  }
+  this->offsetBits = log2i(blockSize);
+  this->setMask = setNum - 1;
+  this->maxAssociativity = maxAssociativity;
+  this->setSlot = std::vector<uint32_t>(setNum, uint32_t(-1));
+  this->readDistance = std::vector<uint64_t>(maxAssociativity + 1, 0);
+  this->writeDistance = std::vector<uint64_t>(maxAssociativity + 1, 0);
+  this->dirtyEviction = std::vector<uint64_t>(log2i(maxAssociativity) + 1, 0);
+}
+
+void StackDistance::access(uint32_t addr, bool isWrite) {
+  uint32_t block = addr >> this->offsetBits;
+  uint32_t set = block & this->setMask;
+  uint32_t slot = this->setSlot[set];
+  if (slot == uint32_t(-1)) {
+    slot = this->stackDepth.size();
+    this->setSlot[set] = slot;
+    this->stackDepth.push_back(0);
+    this->stacks.resize(this->stacks.size() + this->maxAssociativity);
+  }
+  Entry *stack = &this->stacks[size_t(slot) * this->maxAssociativity];
+  uint32_t depth = this->stackDepth[slot];
+
+  uint32_t distance = 0;
+  while (distance < depth && stack[distance].block != block) {
+    distance++;
+  }
+
+  Entry entry;
+  uint32_t bucket;
+  if (distance < depth) {
+    // Caches with no more than distance ways missed and refetched the line
+    entry = stack[distance];
+    if (distance > 0) {
+      entry.dirty &= ~((2u << log2i(distance)) - 1);
+    }
+    bucket = distance;
+  } else {
+    entry.block = block;
+    entry.dirty = 0;
+    if (depth < this->maxAssociativity) {
+      this->stackDepth[slot]++;
+    }
+    bucket = this->maxAssociativity;
+  }
+
+  // Push down every line above the accessed one. A line moving from depth
+  // j to j + 1 leaves the cache with j + 1 ways; the line pushed past the
+  // bottom of a full stack leaves the largest cache and is dropped.
+  for (uint32_t j = distance; j-- > 0;) {
+    uint32_t ways = j + 1;
+    if ((ways & (ways - 1)) == 0) {
+      uint32_t bit = 1u << log2i(ways);
+      if (stack[j].dirty & bit) {
+        this->dirtyEviction[log2i(ways)]++;
+        stack[j].dirty &= ~bit;
+      }
+    }
+    if (ways < this->maxAssociativity) {
+      stack[j + 1] = stack[j];
+    }
+  }
+
+  if (isWrite) {
+    this->writeDistance[bucket]++;
+    entry.dirty = (2u << log2i(this->maxAssociativity)) - 1;
+  } else {
+    this->readDistance[bucket]++;
+  }
+  stack[0] = entry;
+}
+
+StackDistance::Result StackDistance::getResult(uint32_t associativity) {
+  Result result;
+  result.numHit = 0;
+  result.numMiss = 0;
+  result.numWrite = 0;
+  for (uint32_t d = 0; d <= this->maxAssociativity; ++d) {
+    uint64_t count = this->readDistance[d] + this->writeDistance[d];
+    result.numWrite += this->writeDistance[d];
+    if (d < associativity) {
+      result.numHit += count;
+    } else {
+      result.numMiss += count;
+    }
+  }
+  result.numDirtyEviction = this->dirtyEviction[log2i(associativity)];
+  return result;
+}
+
+uint32_t StackDistance::log2i(uint32_t val) {
+  uint32_t ret = 0;
+  while (val > 1) {
+    val >>= 1;
+    ret++;
+  }
+  return ret;
+}
@@ -0,0 +1,61 @@
+/*
+ * Mattson-style LRU stack distance engine
+ *
+ * Keeps one LRU stack per cache set for a fixed block size and set count.
+ * A single pass over a trace gives the hit and miss counts of every
+ * write-allocate LRU cache of that geometry with up to maxAssociativity
+ * ways, along with the writes and dirty evictions needed to cost the
+ * write-through and write-back variants.
+ */
+
+#ifndef STACK_DISTANCE_H
+#define STACK_DISTANCE_H
+
+#include <cstdint>
+#include <vector>
+
+class StackDistance {
+public:
+  static const uint32_t MAX_ASSOCIATIVITY = 32;
+
+  struct Result {
+    uint64_t numHit;
+    uint64_t numMiss;
+    uint64_t numWrite;
+    uint64_t numDirtyEviction;
+  };
+
+  StackDistance(uint32_t blockSize, uint32_t setNum,
+                uint32_t maxAssociativity);
+
+  void access(uint32_t addr, bool isWrite);
+
+  // Associativity must be a power of two no larger than maxAssociativity
+  Result getResult(uint32_t associativity);
+
+private:
+  struct Entry {
+    uint32_t block;
+    // Bit k is set if the line is dirty in the cache with 2^k ways
+    uint32_t dirty;
+  };
+
+  uint32_t offsetBits;
+  uint32_t setMask;
+  uint32_t maxAssociativity;
+
+  // Stacks are allocated the first time their set is touched
+  std::vector<uint32_t> setSlot;
+  std::vector<uint32_t> stackDepth;
+  std::vector<Entry> stacks;
+
+  // Distance histograms, the last bucket counts misses in every cache
+  std::vector<uint64_t> readDistance;
+  std::vector<uint64_t> writeDistance;
+  // Dirty evictions indexed by log2(associativity)
+  std::vector<uint64_t> dirtyEviction;
+
+  static uint32_t log2i(uint32_t val);
+};
+
+#endif
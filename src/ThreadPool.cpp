@@ -0,0 +1,62 @@
+/*
+ * Implementation of the work-stealing thread pool
+ */
+
+#include <thread>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32_t threadNum) {
+  this->threadNum = threadNum > 0 ? threadNum : 1;
+}
+
+void ThreadPool::run(const std::vector<std::function<void()>> &tasks) {
+  if (this->threadNum == 1) {
+    for (const std::function<void()> &task : tasks) {
+      task();
+    }
+    return;
+  }
+
+  std::vector<WorkQueue> queues(this->threadNum);
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    queues[i % this->threadNum].tasks.push_back(i);
+  }
+
+  // Tasks never spawn new tasks, so a worker that finds every queue empty
+  // can retire
+  std::vector<std::thread> workers;
+  for (uint32_t self = 0; self < this->threadNum; ++self) {
+    workers.push_back(std::thread([this, &queues, &tasks, self]() {
+      size_t task;
+      while (this->takeTask(queues, self, task)) {
+        tasks[task]();
+      }
+    }));
+  }
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+bool ThreadPool::takeTask(std::vector<WorkQueue> &queues, uint32_t self,
+                          size_t &task) {
+  {
+    std::lock_guard<std::mutex> guard(queues[self].lock);
+    if (!queues[self].tasks.empty()) {
+      task = queues[self].tasks.front();
+      queues[self].tasks.pop_front();
+      return true;
+    }
+  }
+  for (uint32_t i = 1; i < this->threadNum; ++i) {
+    WorkQueue &victim = queues[(self + i) % this->threadNum];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
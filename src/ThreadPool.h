@@ -0,0 +1,37 @@
+/*
+ * A minimal work-stealing thread pool
+ *
+ * Tasks are dealt round-robin into one deque per worker. A worker takes
+ * tasks from the front of its own deque and, once that is empty, steals
+ * from the back of the others, so a few slow tasks do not leave the rest
+ * of the pool idle.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+class ThreadPool {
+public:
+  explicit ThreadPool(uint32_t threadNum);
+
+  // Run every task and return once all of them have finished
+  void run(const std::vector<std::function<void()>> &tasks);
+
+private:
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+  };
+
+  uint32_t threadNum;
+
+  bool takeTask(std::vector<WorkQueue> &queues, uint32_t self, size_t &task);
+};
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Convert a text memory trace to the compact binary trace format
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "Trace.h"
+
+bool parseParameters(int argc, char **argv);
+void printUsage();
+
+const char *traceFilePath;
+
+int main(int argc, char **argv) {
+  if (!parseParameters(argc, argv)) {
+    printUsage();
+    return -1;
+  }
+  TraceReader reader;
+  if (!reader.open(traceFilePath)) {
+    printf("Invalid file path %s\n", traceFilePath);
+    return -1;
+  }
+  if (reader.isBinary()) {
+    printf("%s is already a binary trace\n", traceFilePath);
+    return -1;
+  }
+  std::string outPath = std::string(traceFilePath) + ".bin";
+  TraceWriter writer;
+  if (!writer.open(outPath.c_str(), reader.hasPC())) {
+    printf("Unable to create file %s\n", outPath.c_str());
+    return -1;
+  }
+
+  TraceRecord record;
+  uint64_t count = 0;
+  while (reader.next(record)) {
+    writer.write(record);
+    count++;
+  }
+  if (!writer.close()) {
+    printf("Failed to write %s\n", outPath.c_str());
+    return -1;
+  }
+  printf("Converted %llu records to %s\n", (unsigned long long)count,
+         outPath.c_str());
+  return 0;
+}
+
+bool parseParameters(int argc, char **argv) {
+  // Read Parameters
+  if (argc > 1) {
+    traceFilePath = argv[1];
+    return true;
+  } else {
+    return false;
+  }
+}
+
+void printUsage() { printf("Usage: ToBinaryTrace trace-file\n"); }
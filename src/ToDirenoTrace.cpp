@@ -8,6 +8,8 @@
 #include <fstream>
 #include <iostream>
 
+#include "Trace.h"
+
 bool parseParameters(int argc, char **argv);
 void printUsage();
 
@@ -17,17 +19,17 @@ int main(int argc, char **argv) {
   if (!parseParameters(argc, argv)) {
     return -1;
   }
-  std::ifstream infile(traceFilePath);
-  std::ofstream outfile(std::string(traceFilePath) + ".d4");
-  if (!infile.is_open()) {
+  TraceReader reader;
+  if (!reader.open(traceFilePath)) {
     printf("Invalid file path %s\n", traceFilePath);
     return -1;
   }
+  std::ofstream outfile(std::string(traceFilePath) + ".d4");
 
-  char type;
-  uint32_t addr;
-  while (infile >> type >> std::hex >> addr) {
-    outfile << type << " " << std::hex << addr << " " << 1 << std::endl;
+  TraceRecord record;
+  while (reader.next(record)) {
+    outfile << (record.isWrite ? 'w' : 'r') << " " << std::hex << record.addr
+            << " " << record.size << "\n";
   }
   return 0;
 }
@@ -0,0 +1,315 @@
+/*
+ * Implementation of the memory trace reader and writer
+ */
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Debug.h"
+#include "Trace.h"
+
+namespace {
+
+const size_t HEADER_SIZE = 24;
+
+inline uint32_t zigzagEncode(uint32_t delta) {
+  return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+inline uint32_t zigzagDecode(uint32_t val) {
+  return (val >> 1) ^ (uint32_t)(-(int32_t)(val & 1));
+}
+
+inline uint32_t log2Size(uint32_t size) {
+  switch (size) {
+  case 1:
+    return 0;
+  case 2:
+    return 1;
+  case 4:
+    return 2;
+  case 8:
+    return 3;
+  default:
+    dbgprintf("Illegal access size %u in trace\n", size);
+    exit(-1);
+  }
+}
+
+} // namespace
+
+TraceReader::TraceReader() {
+  this->fd = -1;
+  this->data = nullptr;
+  this->length = 0;
+  this->pos = 0;
+  this->binary = false;
+  this->flags = 0;
+  this->totalRecords = 0;
+  this->remainingRecords = 0;
+  this->lastAddr = 0;
+  this->lastPC = 0;
+}
+
+TraceReader::~TraceReader() { this->close(); }
+
+bool TraceReader::open(const char *path) {
+  this->close();
+  this->fd = ::open(path, O_RDONLY);
+  if (this->fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(this->fd, &st) != 0) {
+    this->close();
+    return false;
+  }
+  this->length = st.st_size;
+  if (this->length > 0) {
+    void *addr = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, this->fd,
+                      0);
+    if (addr == MAP_FAILED) {
+      this->close();
+      return false;
+    }
+    madvise(addr, this->length, MADV_SEQUENTIAL);
+    this->data = (const uint8_t *)addr;
+  }
+
+  if (this->length >= HEADER_SIZE &&
+      memcmp(this->data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) {
+    uint32_t version;
+    memcpy(&version, this->data + 8, 4);
+    memcpy(&this->flags, this->data + 12, 4);
+    memcpy(&this->totalRecords, this->data + 16, 8);
+    if (version != TRACE_VERSION) {
+      dbgprintf("Unsupported binary trace version %u\n", version);
+      this->close();
+      return false;
+    }
+    this->binary = true;
+    this->remainingRecords = this->totalRecords;
+    this->pos = HEADER_SIZE;
+  } else {
+    // The first line tells whether the text trace has a PC column
+    TraceRecord record;
+    this->nextText(record);
+    this->pos = 0;
+  }
+  return true;
+}
+
+void TraceReader::close() {
+  if (this->data != nullptr) {
+    munmap((void *)this->data, this->length);
+  }
+  if (this->fd >= 0) {
+    ::close(this->fd);
+  }
+  this->fd = -1;
+  this->data = nullptr;
+  this->length = 0;
+  this->pos = 0;
+  this->binary = false;
+  this->flags = 0;
+  this->totalRecords = 0;
+  this->remainingRecords = 0;
+  this->lastAddr = 0;
+  this->lastPC = 0;
+}
+
+bool TraceReader::next(TraceRecord &record) {
+  if (this->binary) {
+    return this->nextBinary(record);
+  }
+  return this->nextText(record);
+}
+
+bool TraceReader::isBinary() { return this->binary; }
+
+bool TraceReader::hasPC() { return (this->flags & TRACE_FLAG_PC) != 0; }
+
+uint64_t TraceReader::recordNum() { return this->totalRecords; }
+
+bool TraceReader::nextBinary(TraceRecord &record) {
+  if (this->remainingRecords == 0 || this->pos >= this->length) {
+    return false;
+  }
+  uint8_t control = this->data[this->pos++];
+  uint32_t delta;
+  if (!this->readVarint(delta)) {
+    dbgprintf("Truncated binary trace\n");
+    exit(-1);
+  }
+  this->lastAddr += zigzagDecode(delta);
+  record.addr = this->lastAddr;
+  record.isWrite = control & 0x1;
+  record.size = 1 << ((control >> 1) & 0x3);
+  record.pc = 0;
+  if (this->flags & TRACE_FLAG_PC) {
+    if (!this->readVarint(delta)) {
+      dbgprintf("Truncated binary trace\n");
+      exit(-1);
+    }
+    this->lastPC += zigzagDecode(delta);
+    record.pc = this->lastPC;
+  }
+  this->remainingRecords--;
+  return true;
+}
+
+bool TraceReader::nextText(TraceRecord &record) {
+  // Hand-rolled equivalent of "trace >> type >> std::hex >> addr"
+  const uint8_t *p = this->data + this->pos;
+  const uint8_t *end = this->data + this->length;
+  while (p < end && isspace(*p))
+    p++;
+  if (p == end) {
+    this->pos = this->length;
+    return false;
+  }
+  char type = *p++;
+  while (p < end && isspace(*p))
+    p++;
+  if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    p += 2;
+  uint32_t addr = 0;
+  const uint8_t *digits = p;
+  while (p < end && isxdigit(*p)) {
+    uint32_t c = *p++;
+    addr = (addr << 4) |
+           (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+  }
+  if (p == digits) {
+    dbgprintf("Malformed trace line %zu\n", this->getLineNum(p));
+    exit(-1);
+  }
+  // An optional PC follows the address on the same line
+  uint32_t pc = 0;
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    p += 2;
+  if (p < end && isxdigit(*p)) {
+    this->flags |= TRACE_FLAG_PC;
+  }
+  while (p < end && isxdigit(*p)) {
+    uint32_t c = *p++;
+    pc = (pc << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+  }
+  while (p < end && *p != '\n' && isspace(*p))
+    p++;
+  if (p < end && *p != '\n') {
+    dbgprintf("Malformed trace line %zu\n", this->getLineNum(p));
+    exit(-1);
+  }
+  if (type != 'r' && type != 'w') {
+    dbgprintf("Illegal type %c in trace line %zu\n", type,
+              this->getLineNum(p));
+    exit(-1);
+  }
+  this->pos = p - this->data;
+  record.addr = addr;
+  record.pc = pc;
+  record.size = 1;
+  record.isWrite = type == 'w';
+  return true;
+}
+
+size_t TraceReader::getLineNum(const uint8_t *p) {
+  // Only used for errors, so the lines are counted from the start
+  size_t line = 1;
+  for (const uint8_t *q = this->data; q < p; ++q) {
+    if (*q == '\n')
+      line++;
+  }
+  return line;
+}
+
+bool TraceReader::readVarint(uint32_t &val) {
+  val = 0;
+  for (uint32_t shift = 0; shift < 35; shift += 7) {
+    if (this->pos >= this->length) {
+      return false;
+    }
+    uint8_t byte = this->data[this->pos++];
+    val |= uint32_t(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TraceWriter::TraceWriter() {
+  this->file = nullptr;
+  this->pcField = false;
+  this->totalRecords = 0;
+  this->lastAddr = 0;
+  this->lastPC = 0;
+}
+
+TraceWriter::~TraceWriter() { this->close(); }
+
+bool TraceWriter::open(const char *path, bool hasPC) {
+  this->close();
+  this->file = fopen(path, "wb");
+  if (this->file == nullptr) {
+    return false;
+  }
+  setvbuf(this->file, nullptr, _IOFBF, 1 << 20);
+  this->pcField = hasPC;
+  this->totalRecords = 0;
+  this->lastAddr = 0;
+  this->lastPC = 0;
+
+  // The record count is filled in by close()
+  uint8_t header[HEADER_SIZE];
+  uint32_t flags = hasPC ? TRACE_FLAG_PC : 0;
+  memset(header, 0, sizeof(header));
+  memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  memcpy(header + 8, &TRACE_VERSION, 4);
+  memcpy(header + 12, &flags, 4);
+  return fwrite(header, 1, sizeof(header), this->file) == sizeof(header);
+}
+
+void TraceWriter::write(const TraceRecord &record) {
+  uint8_t buf[16];
+  size_t len = 0;
+  buf[len++] = (record.isWrite ? 0x1 : 0x0) | (log2Size(record.size) << 1);
+  len += writeVarint(buf + len, zigzagEncode(record.addr - this->lastAddr));
+  this->lastAddr = record.addr;
+  if (this->pcField) {
+    len += writeVarint(buf + len, zigzagEncode(record.pc - this->lastPC));
+    this->lastPC = record.pc;
+  }
+  fwrite(buf, 1, len, this->file);
+  this->totalRecords++;
+}
+
+bool TraceWriter::close() {
+  if (this->file == nullptr) {
+    return true;
+  }
+  bool good = fseek(this->file, 16, SEEK_SET) == 0 &&
+              fwrite(&this->totalRecords, 8, 1, this->file) == 1;
+  good = fclose(this->file) == 0 && good;
+  this->file = nullptr;
+  return good;
+}
+
+size_t TraceWriter::writeVarint(uint8_t *buf, uint32_t val) {
+  size_t len = 0;
+  while (val >= 0x80) {
+    buf[len++] = (val & 0x7F) | 0x80;
+    val >>= 7;
+  }
+  buf[len++] = val;
+  return len;
+}
@@ -0,0 +1,99 @@
+/*
+ * Memory trace reader and writer
+ *
+ * Two formats are understood. The text format has one "r/w hexaddr [hexpc]"
+ * access per line and every access is one byte wide. The trace has PCs if
+ * its first line has one, and lines without a PC read as PC 0. The binary format starts
+ * with a fixed header followed by variable length records:
+ *
+ *   Header   char magic[8]       "RVTRACE\0"
+ *            uint32_t version    TRACE_VERSION
+ *            uint32_t flags      TRACE_FLAG_PC if records carry a PC
+ *            uint64_t recordNum
+ *   Record   uint8_t control     bit 0 write, bits 1-2 log2(size)
+ *            varint  addrDelta   zigzag encoded, from the previous address
+ *            varint  pcDelta     zigzag encoded, only with TRACE_FLAG_PC
+ *
+ * All integers are little-endian. The reader maps the file into memory and
+ * decodes records in place, detecting the format from the magic.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+const char TRACE_MAGIC[8] = {'R', 'V', 'T', 'R', 'A', 'C', 'E', '\0'};
+const uint32_t TRACE_VERSION = 1;
+const uint32_t TRACE_FLAG_PC = 0x1;
+
+struct TraceRecord {
+  uint32_t addr;
+  uint32_t pc; // 0 if the trace has no PC field
+  uint32_t size; // in bytes, 1, 2, 4 or 8
+  bool isWrite;
+};
+
+class TraceReader {
+public:
+  TraceReader();
+  ~TraceReader();
+  TraceReader(const TraceReader &) = delete;
+  TraceReader &operator=(const TraceReader &) = delete;
+
+  bool open(const char *path);
+  void close();
+
+  // Returns false at the end of the trace
+  bool next(TraceRecord &record);
+
+  bool isBinary();
+  bool hasPC();
+  // Number of records in a binary trace, 0 if unknown
+  uint64_t recordNum();
+
+private:
+  int fd;
+  const uint8_t *data;
+  size_t length;
+  size_t pos;
+
+  bool binary;
+  uint32_t flags;
+  uint64_t totalRecords;
+  uint64_t remainingRecords;
+  uint32_t lastAddr;
+  uint32_t lastPC;
+
+  bool nextBinary(TraceRecord &record);
+  bool nextText(TraceRecord &record);
+  bool readVarint(uint32_t &val);
+  // Line of a text trace that p points into, starting from 1
+  size_t getLineNum(const uint8_t *p);
+};
+
+class TraceWriter {
+public:
+  TraceWriter();
+  ~TraceWriter();
+  TraceWriter(const TraceWriter &) = delete;
+  TraceWriter &operator=(const TraceWriter &) = delete;
+
+  bool open(const char *path, bool hasPC);
+  void write(const TraceRecord &record);
+  // Flushes the records and fills in the record count of the header
+  bool close();
+
+private:
+  FILE *file;
+  bool pcField;
+  uint64_t totalRecords;
+  uint32_t lastAddr;
+  uint32_t lastPC;
+
+  static size_t writeVarint(uint8_t *buf, uint32_t val);
+};
+
+#endif
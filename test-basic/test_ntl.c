@@ -0,0 +1,89 @@
+#include "lib.h"
+
+// Streaming copies larger than L1, plain and with each of the Zihintntl
+// hints (add x0, x0, x2 to x5) before their loads and stores. Hinted
+// misses skip the hinted cache levels, the copied data and a table read
+// between the copies must come out the same either way
+
+#define STREAM_N 16384 // 64 KiB
+#define TABLE_N 2048   // 8 KiB
+
+int src[STREAM_N];
+int dst[STREAM_N];
+int table[TABLE_N];
+
+// The hint applies to the next instruction, so each hint and its access
+// are emitted together
+#define NTL_LOAD(hint, val, ptr)                                              \
+  asm volatile(hint "\n\tlw %0, 0(%1)" : "=r"(val) : "r"(ptr) : "memory")
+#define NTL_STORE(hint, val, ptr)                                             \
+  asm volatile(hint "\n\tsw %0, 0(%1)" : : "r"(val), "r"(ptr) : "memory")
+
+#define DEFINE_COPY(name, hint)                                               \
+  void name() {                                                               \
+    for (int i = 0; i < STREAM_N; ++i) {                                      \
+      int val;                                                                \
+      NTL_LOAD(hint, val, &src[i]);                                           \
+      NTL_STORE(hint, val, &dst[i]);                                          \
+    }                                                                         \
+  }
+
+void copy_plain() {
+  for (int i = 0; i < STREAM_N; ++i) {
+    dst[i] = src[i];
+  }
+}
+
+DEFINE_COPY(copy_ntl_p1, "add x0, x0, x2")
+DEFINE_COPY(copy_ntl_pall, "add x0, x0, x3")
+DEFINE_COPY(copy_ntl_s1, "add x0, x0, x4")
+DEFINE_COPY(copy_ntl_all, "add x0, x0, x5")
+
+int sum_table() {
+  int sum = 0;
+  for (int i = 0; i < TABLE_N; ++i) {
+    sum += table[i];
+  }
+  return sum;
+}
+
+int check(const char *name, int expected) {
+  int good = 1;
+  for (int i = 0; i < STREAM_N; ++i) {
+    if (dst[i] != src[i]) {
+      good = 0;
+    }
+    dst[i] = 0;
+  }
+  int sum = sum_table();
+  print_s(name);
+  print_s(good && sum == expected ? ": ok, table sum " : ": FAILED, sum ");
+  print_d(sum);
+  print_c('\n');
+  return good && sum == expected;
+}
+
+int main() {
+  for (int i = 0; i < STREAM_N; ++i) {
+    src[i] = i * 3 + 1;
+  }
+  for (int i = 0; i < TABLE_N; ++i) {
+    table[i] = i;
+  }
+  int expected = sum_table();
+
+  int good = 1;
+  copy_plain();
+  good &= check("plain", expected);
+  copy_ntl_p1();
+  good &= check("ntl.p1", expected);
+  copy_ntl_pall();
+  good &= check("ntl.pall", expected);
+  copy_ntl_s1();
+  good &= check("ntl.s1", expected);
+  copy_ntl_all();
+  good &= check("ntl.all", expected);
+
+  print_s(good ? "All copies correct\n" : "Copy FAILED\n");
+  exit_proc();
+}